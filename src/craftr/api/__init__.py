@@ -55,6 +55,7 @@ import sys
 import toml
 
 from craftr.core import build as _build
+from craftr.core.toolid import ToolIdentityCache
 from dataclasses import dataclass
 from nodepy.utils import pathlib
 from craftr.utils.maps import ObjectFromDict
@@ -125,6 +126,8 @@ class Session(_build.Master):
     self._build_variant = build_variant
     self._current_scopes = []
     self.graph_filename = nr.fs.join(build_root, 'craftr_graph.{}.json'.format(build_variant))
+    # The identities of the tools are shared between all build variants.
+    self.tool_identities = ToolIdentityCache(nr.fs.join(build_root, 'craftr_tools.json'))
     self.cli_options = cli_options
     self.options = {}
     self.loader = CraftrModuleLoader(self)
@@ -225,6 +228,27 @@ class Session(_build.Master):
   def build_variant(self):
     return self._build_variant
 
+  @property
+  def reproducible(self):
+    """
+    #True if the `build:reproducible` option is enabled. Modules should then
+    produce outputs that only depend on their inputs and not on the time or
+    the location of the build. The backends set the `SOURCE_DATE_EPOCH`
+    environment variable to #source_date_epoch for all commands.
+    """
+
+    return str(self.options.get('build:reproducible', False)).lower() in ('true', '1', 'yes', 'on')
+
+  @property
+  def source_date_epoch(self):
+    """
+    The timestamp that is used instead of the current time in reproducible
+    builds, from the `build:sourceDateEpoch` option. Defaults to 0, which
+    keeps the outputs identical between commits (eg. for the action cache).
+    """
+
+    return int(self.options.get('build:sourceDateEpoch', 0))
+
   @contextlib.contextmanager
   def enter_scope(self, name, version, directory):
     scope = Scope(self, name, version, directory)
@@ -268,6 +292,7 @@ class Session(_build.Master):
       filename = self.graph_filename
     nr.fs.makedirs(nr.fs.dir(filename))
     super().save(filename)
+    self.tool_identities.save()
 
   def load(self, filename=None):
     if not filename:
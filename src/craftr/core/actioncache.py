@@ -0,0 +1,667 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""
+An action cache for the build sets of operators that are marked as
+#Operator.cacheable. Before such a build set is executed, its action key is
+computed from the #BuildSet.compute_hash(), the contents of its input files
+and the identity of the tools that it runs. If the cache has a result for
+the key, the output files are taken from the cache instead of executing the
+commands.
+
+The cache consists of a local #DiskStore, which is enabled by default
+(`build:actionCache`), and an optional #HttpStore that
+can be shared between machines. Both use the same layout as bazel-remote's
+HTTP interface, where `ac/<key>` contains the JSON encoded action results
+and `cas/<digest>` contains the output files addressed by their SHA256
+digest. The `cache-server` tool serves a directory with this layout.
+
+Build sets with a depfile have a two-level entry: the entry for the action
+key lists the files that were read according to the depfile, and the result
+is stored under a key that also covers the contents of these files.
+
+GCC compatible compilers leave the system headers out of the depfile with
+`-MMD`. Machines with different system headers but the same compiler would
+then share entries, thus the cxx module uses `-MD` when the remote cache is
+enabled. The local cache keeps the behaviour of incremental builds: an
+update of the system headers does not invalidate its entries (run
+`craftr --tool cache clear` after such an update).
+
+With `build:relocatableKeys`, the source root (`build:sourceRoot`, defaults
+to the current directory), the build root and the `build:toolchainRoots`
+are replaced with placeholders in the action keys, the recorded depfile
+inputs and the cached depfiles (see #get_path_roots()). Checkouts of the
+same commit in different directories then share cache entries. The cxx
+module maps these roots in the compiled objects with `-ffile-prefix-map`.
+
+The output files are created from the local store with a reflink (copy on
+write) if the file system supports it, otherwise as a hardlink or a copy
+(see `build:actionCacheMaterialize`). The files in the store are read-only,
+and the outputs of cacheable build sets are unlinked before the commands
+are executed (#ActionCache.prepare()), so that a command can not modify a
+file in the store through a hardlink.
+"""
+
+__all__ = ['ActionCache', 'DiskStore', 'HttpStore', 'file_digest', 'read_depfile']
+
+import hashlib
+import json
+import time
+import nr.fs
+import os
+import shutil
+import sys
+import urllib.error
+import urllib.request
+
+from nr.stream import Stream as stream
+from typing import Dict, List
+from .build import relocate_paths
+
+ENVIRON_KEY = 'CRAFTR_ACTION_CACHE'
+TOKEN_ENVIRON_KEY = 'CRAFTR_CACHE_TOKEN'
+MATERIALIZE_MODES = ('auto', 'reflink', 'hardlink', 'copy')
+FICLONE = 0x40049409  # Linux ioctl to create a reflink.
+SIZE_SUFFIXES = {'K': 1 << 10, 'M': 1 << 20, 'G': 1 << 30, 'T': 1 << 40}
+_tool_digests = {}
+
+
+def file_digest(filename: str) -> str:
+  hasher = hashlib.sha256()
+  with open(filename, 'rb') as fp:
+    for chunk in iter(lambda: fp.read(1 << 16), b''):
+      hasher.update(chunk)
+  return hasher.hexdigest()
+
+
+def data_digest(data: bytes) -> str:
+  return hashlib.sha256(data).hexdigest()
+
+
+def json_digest(data) -> str:
+  return data_digest(json.dumps(data, sort_keys=True).encode('utf8'))
+
+
+def read_depfile(filename: str) -> List[str]:
+  """
+  Reads a Makefile style depfile as written by GCC compatible compilers and
+  returns the prerequisites of all rules in it.
+  """
+
+  with open(filename) as fp:
+    text = fp.read().replace('\\\n', ' ').replace('\\\r\n', ' ')
+  result = []
+  for line in text.splitlines():
+    prerequisites = line.partition(': ')[2] if ': ' in line else line.rpartition(':')[2]
+    current = ''
+    escape = False
+    for char in prerequisites:
+      if escape:
+        current += char
+        escape = False
+      elif char == '\\':
+        escape = True
+      elif char.isspace():
+        if current:
+          result.append(current)
+        current = ''
+      else:
+        current += char
+    if current:
+      result.append(current)
+  return result
+
+
+def parse_size(value) -> int:
+  """
+  Parses a size with an optional K, M, G or T suffix.
+  """
+
+  value = str(value).strip().upper().rstrip('B')
+  if value and value[-1] in SIZE_SUFFIXES:
+    return int(float(value[:-1]) * SIZE_SUFFIXES[value[-1]])
+  return int(value)
+
+
+def parse_bool(value) -> bool:
+  return str(value).lower() not in ('false', '0', 'no', 'off', '')
+
+
+def reflink(source: str, dest: str):
+  """
+  Creates *dest* as a copy on write clone of *source*. Raises an #OSError if
+  the platform or file system does not support it.
+  """
+
+  if not sys.platform.startswith('linux'):
+    raise OSError('reflinks are not supported on {}'.format(sys.platform))
+  import fcntl
+  with open(source, 'rb') as src, open(dest, 'wb') as dst:
+    try:
+      fcntl.ioctl(dst.fileno(), FICLONE, src.fileno())
+    except OSError:
+      dst.close()
+      os.remove(dest)
+      raise
+
+
+def clone_file(source: str, dest: str, mode: str = 'auto'):
+  """
+  Creates *dest* from *source* with the first method that works in the
+  order of preference given by the materialization *mode*.
+  """
+
+  methods = {
+    'auto': (reflink, os.link, shutil.copyfile),
+    'reflink': (reflink, shutil.copyfile),
+    'hardlink': (os.link, shutil.copyfile),
+    'copy': (shutil.copyfile,)
+  }[mode]
+  for method in methods[:-1]:
+    try:
+      return method(source, dest)
+    except OSError:
+      pass
+  methods[-1](source, dest)
+
+
+def get_path_roots(options: Dict, build_root: str, always: bool = False) -> Dict[str, str]:
+  """
+  Returns the root directories that are replaced with placeholders in the
+  action keys, mapped by the placeholder name. Returns an empty dictionary
+  unless `build:relocatableKeys` is enabled or *always* is #True. `build:toolchainRoots` is a
+  list (or a comma separated string) of directories, eg. the installation
+  directory of a compiler that is not in the same location on all machines.
+  """
+
+  if not always and not parse_bool(options.get('build:relocatableKeys', False)):
+    return {}
+  roots = {'SOURCE': options.get('build:sourceRoot') or os.getcwd(), 'BUILD': build_root}
+  toolchain_roots = options.get('build:toolchainRoots') or []
+  if isinstance(toolchain_roots, str):
+    toolchain_roots = [x for x in toolchain_roots.split(',') if x.strip()]
+  for index, root in enumerate(toolchain_roots):
+    roots['TOOLCHAIN{}'.format(index)] = root.strip()
+  return {k: nr.fs.canonical(v) for k, v in roots.items()}
+
+
+def get_tool_identity(command: List[str], exclude: str = None) -> str:
+  """
+  Returns the identity of the program that is executed by *command*, which
+  is the digest of its contents. Returns #None if the program is the
+  *exclude* path, eg. the #Operator.tool whose identity is already part of
+  the #BuildSet.compute_hash(). The digests are remembered as long as the
+  modification time and inode of the program do not change.
+  """
+
+  program = shutil.which(command[0]) if command else None
+  if not program:
+    return None
+  program = os.path.realpath(program)
+  if program == exclude:
+    return None
+  st = os.stat(program)
+  key = (program, st.st_mtime_ns, st.st_ino)
+  if key not in _tool_digests:
+    _tool_digests[key] = file_digest(program)
+  return _tool_digests[key]
+
+
+class DiskStore:
+  """
+  A store in a local directory.
+  """
+
+  def __init__(self, directory: str):
+    self.directory = directory
+
+  def __repr__(self):
+    return 'DiskStore({!r})'.format(self.directory)
+
+  def _write(self, kind, key, write):
+    filename = self.path(kind, key)
+    nr.fs.makedirs(os.path.dirname(filename))
+    temp = '{}.{}.tmp'.format(filename, os.getpid())
+    write(temp)
+    if kind == 'cas' and os.name != 'nt':
+      os.chmod(temp, 0o444)
+    os.replace(temp, filename)
+
+  def path(self, kind: str, key: str) -> str:
+    return os.path.join(self.directory, kind, key[:2], key)
+
+  def contains(self, kind: str, key: str) -> bool:
+    return os.path.isfile(self.path(kind, key))
+
+  def get(self, kind: str, key: str) -> bytes:
+    try:
+      with open(self.path(kind, key), 'rb') as fp:
+        return fp.read()
+    except FileNotFoundError:
+      return None
+
+  def put(self, kind: str, key: str, data: bytes):
+    def write(temp):
+      with open(temp, 'wb') as fp:
+        fp.write(data)
+    self._write(kind, key, write)
+
+  def put_file(self, kind: str, key: str, source: str):
+    if not os.path.isfile(self.path(kind, key)):
+      self._write(kind, key, lambda temp: clone_file(source, temp, 'reflink'))
+
+  def touch(self, kind: str, key: str):
+    """
+    Marks an entry as used, which protects it from #gc() the longest.
+    """
+
+    try:
+      os.utime(self.path(kind, key))
+    except OSError:
+      pass
+
+  def record(self, event: str):
+    """
+    Counts a cache *event* (`hits` or `misses`) for #stats(). The counters are
+    files to which every process appends a single byte.
+    """
+
+    nr.fs.makedirs(self.directory)
+    with open(os.path.join(self.directory, event), 'ab') as fp:
+      fp.write(b'.')
+
+  def entries(self):
+    """
+    Yields the path, size and modification time of all files in the store.
+    """
+
+    for kind in ('ac', 'cas'):
+      for root, dirs, files in os.walk(os.path.join(self.directory, kind)):
+        for name in files:
+          filename = os.path.join(root, name)
+          try:
+            st = os.stat(filename)
+          except FileNotFoundError:
+            continue
+          yield filename, st.st_size, st.st_mtime
+
+  def stats(self) -> Dict:
+    result = {'ac': 0, 'cas': 0, 'size': 0, 'hits': 0, 'misses': 0}
+    for filename, size, mtime in self.entries():
+      kind = os.path.relpath(filename, self.directory).split(os.sep)[0]
+      result[kind] += 1
+      result['size'] += size
+    for event in ('hits', 'misses'):
+      try:
+        result[event] = os.path.getsize(os.path.join(self.directory, event))
+      except OSError:
+        pass
+    return result
+
+  def gc(self, max_size: int, max_age: float = None) -> (int, int):
+    """
+    Removes the least recently used files until the store is smaller than
+    *max_size* bytes, as well as files that were not used for *max_age*
+    seconds. Results whose files were removed are misses the next time
+    they are looked up. Returns the number and total size of the removed
+    files.
+    """
+
+    entries = sorted(self.entries(), key=lambda x: x[2])
+    total = sum(x[1] for x in entries)
+    now = time.time()
+    removed, removed_size = 0, 0
+    for filename, size, mtime in entries:
+      expired = max_age is not None and now - mtime > max_age
+      temp = filename.endswith('.tmp') and now - mtime > 3600
+      if total <= max_size and not expired and not temp:
+        continue
+      try:
+        os.remove(filename)
+      except OSError:
+        continue
+      total -= size
+      removed += 1
+      removed_size += size
+    return removed, removed_size
+
+  def clear(self):
+    if os.path.isdir(self.directory):
+      shutil.rmtree(self.directory)
+
+
+class HttpStore:
+  """
+  A store behind a HTTP server that supports GET, HEAD and PUT requests, for
+  example bazel-remote or the `cache-server` tool. The store is disabled for
+  the rest of the process after the first connection error, so that an
+  unreachable server does not slow down the build.
+
+  The *token* is sent as a bearer token with every request. It defaults to
+  the `CRAFTR_CACHE_TOKEN` environment variable, so that it does not end up
+  in the build configuration that is passed on to the build backend.
+  """
+
+  def __init__(self, url: str, upload: bool = True, timeout: float = 10.0, token: str = None):
+    self.url = url.rstrip('/')
+    self.upload = upload
+    self.timeout = timeout
+    self.token = token or os.environ.get(TOKEN_ENVIRON_KEY) or None
+    self.available = True
+
+  def __repr__(self):
+    return 'HttpStore({!r})'.format(self.url)
+
+  def _request(self, method, kind, key, data=None):
+    if not self.available:
+      return None
+    request = urllib.request.Request('{}/{}/{}'.format(self.url, kind, key),
+      data=data, method=method)
+    if self.token:
+      request.add_header('Authorization', 'Bearer {}'.format(self.token))
+    try:
+      with urllib.request.urlopen(request, timeout=self.timeout) as response:
+        return response.read()
+    except urllib.error.HTTPError as exc:
+      if exc.code != 404:
+        print('warning: remote cache: {} {}/{} failed with {}'.format(method, kind, key, exc.code),
+          file=sys.stderr)
+      return None
+    except (urllib.error.URLError, OSError) as exc:
+      print('warning: remote cache "{}" is not available ({})'.format(self.url, exc), file=sys.stderr)
+      self.available = False
+      return None
+
+  def contains(self, kind: str, key: str) -> bool:
+    return self._request('HEAD', kind, key) is not None
+
+  def get(self, kind: str, key: str) -> bytes:
+    return self._request('GET', kind, key)
+
+  def put(self, kind: str, key: str, data: bytes):
+    if self.upload:
+      self._request('PUT', kind, key, data)
+
+  def put_file(self, kind: str, key: str, source: str):
+    if self.upload and not self.contains(kind, key):
+      with open(source, 'rb') as fp:
+        self.put(kind, key, fp.read())
+
+
+class ActionCache:
+  """
+  Looks up and stores the results of build sets in the *local* store and
+  the optional *remote* store. Results that are only found in the remote
+  store are copied into the local store.
+  """
+
+  def __init__(self, local: DiskStore, remote: HttpStore = None, materialize: str = 'auto',
+               roots: Dict[str, str] = None):
+    if materialize not in MATERIALIZE_MODES:
+      raise ValueError('invalid materialize mode: {!r}'.format(materialize))
+    self.local = local
+    self.remote = remote
+    self.materialize_mode = materialize
+    self.roots = roots or {}
+
+  @staticmethod
+  def get_directory(options: Dict, build_root: str) -> str:
+    directory = options.get('build:actionCacheDirectory') or \
+      os.path.join(build_root, 'craftr_action_cache')
+    return nr.fs.canonical(directory)
+
+  @staticmethod
+  def get_config(options: Dict, build_root: str) -> Dict:
+    """
+    Returns the configuration of the action cache from the session
+    *options*, or #None if the action cache is disabled. The local cache is
+    disabled with `build:actionCache=false`. The remote cache is enabled
+    with the `build:remoteCache` option, which is the URL of the server.
+    Uploads to the server can be disabled with `build:remoteCacheUpload=false`,
+    eg. for developer machines that only read the cache that is populated
+    by CI. The token for uploads is read from the `CRAFTR_CACHE_TOKEN`
+    environment variable (see #HttpStore).
+    """
+
+    url = options.get('build:remoteCache')
+    if not parse_bool(options.get('build:actionCache', True)) and not url:
+      return None
+    upload = parse_bool(options.get('build:remoteCacheUpload', True))
+    materialize = options.get('build:actionCacheMaterialize', 'auto')
+    if materialize not in MATERIALIZE_MODES:
+      raise ValueError('build:actionCacheMaterialize must be one of {}'.format(
+        ', '.join(MATERIALIZE_MODES)))
+    return {'directory': ActionCache.get_directory(options, build_root), 'remote': url or None,
+            'upload': upload, 'materialize': materialize,
+            'roots': get_path_roots(options, build_root)}
+
+  @classmethod
+  def from_config(cls, config: Dict) -> 'ActionCache':
+    if not config:
+      return None
+    remote = HttpStore(config['remote'], config['upload']) if config.get('remote') else None
+    return cls(DiskStore(config['directory']), remote, config.get('materialize', 'auto'),
+               config.get('roots'))
+
+  @classmethod
+  def from_environ(cls) -> 'ActionCache':
+    """
+    Creates the action cache from the configuration that the build backend
+    passed to the process that executes a build set.
+    """
+
+    config = os.environ.get(ENVIRON_KEY)
+    return cls.from_config(json.loads(config)) if config else None
+
+  def _get(self, kind, key):
+    data = self.local.get(kind, key)
+    if data is not None:
+      self.local.touch(kind, key)
+    elif self.remote:
+      data = self.remote.get(kind, key)
+      if data is not None:
+        self.local.put(kind, key, data)
+    return data
+
+  def _put(self, kind, key, data):
+    self.local.put(kind, key, data)
+    if self.remote:
+      self.remote.put(kind, key, data)
+
+  def _put_file(self, digest, filename):
+    self.local.put_file('cas', digest, filename)
+    if self.remote:
+      self.remote.put_file('cas', digest, filename)
+
+  def _fetch_file(self, digest, filename, executable=False):
+    source = self.local.path('cas', digest)
+    if not os.path.isfile(source):
+      data = self.remote.get('cas', digest) if self.remote else None
+      if data is None or data_digest(data) != digest:
+        return False
+      self.local.put('cas', digest, data)
+    else:
+      self.local.touch('cas', digest)
+    self.materialize(source, filename, executable)
+    return True
+
+  def materialize(self, source, filename, executable=False):
+    """
+    Creates the output *filename* from the file *source* in the local store.
+    The modification time is updated, as it would be if the output was
+    produced by the commands (a hardlink shares it with the store).
+    """
+
+    if os.path.isfile(filename) and os.path.samefile(source, filename):
+      os.remove(filename)  # Renaming a hardlink over the same file does nothing.
+    temp = '{}.{}.tmp'.format(filename, os.getpid())
+    if os.path.lexists(temp):
+      os.remove(temp)
+    clone_file(source, temp, self.materialize_mode)
+    if os.name != 'nt' and os.stat(temp).st_nlink == 1:
+      os.chmod(temp, 0o755 if executable else 0o644)
+    elif executable:
+      os.chmod(temp, os.stat(temp).st_mode | 0o111)
+    os.utime(temp)
+    os.replace(temp, filename)
+
+  def prepare(self, build_set):
+    """
+    Removes the output files of *build_set* that are hardlinks into the
+    store, before its commands are executed.
+    """
+
+    for filename in stream.concat(build_set.outputs.values()):
+      try:
+        if os.stat(filename).st_nlink > 1:
+          os.remove(filename)
+      except OSError:
+        pass
+
+  def relocate(self, value):
+    return relocate_paths(value, self.roots) if self.roots else value
+
+  def restore_paths(self, value):
+    return relocate_paths(value, self.roots, restore=True) if self.roots else value
+
+  def get_action_key(self, build_set) -> str:
+    """
+    Returns the key of the *build_set*, or #None if one of its inputs is not
+    a file (eg. a missing optional input or a directory), in which case the
+    build set is not cached.
+    """
+
+    inputs = {}
+    for filename in build_set.get_input_files():
+      if not os.path.isfile(filename):
+        return None
+      inputs[self.relocate(filename)] = file_digest(filename)
+    tool = build_set.operator.tool_identity
+    tools = [get_tool_identity(x, tool and tool['path']) for x in build_set.get_commands()]
+    key_hash = build_set.compute_hash(self.roots or None)
+    epoch = os.environ.get('SOURCE_DATE_EPOCH')
+    return json_digest({'hash': key_hash, 'inputs': inputs, 'tools': tools, 'epoch': epoch})
+
+  def _get_depfile(self, build_set):
+    if not build_set.depfile:
+      return None
+    return self._abs(build_set, build_set.depfile)
+
+  def _abs(self, build_set, filename):
+    return os.path.normpath(os.path.join(build_set.get_cwd() or os.getcwd(), filename))
+
+  def _get_result_key(self, key, implicit_inputs):
+    digests = {}
+    for filename in implicit_inputs:
+      if not os.path.isfile(filename):
+        return None
+      digests[self.relocate(filename)] = file_digest(filename)
+    return json_digest({'key': key, 'implicit_inputs': digests})
+
+  def lookup(self, build_set) -> bool:
+    """
+    Looks up the result of *build_set* and creates its output files (and
+    the depfile) from the cache. Returns #True if the result was found.
+    """
+
+    entry = self._lookup_entry(build_set)
+    if entry is None or not self._restore(build_set, entry):
+      self.local.record('misses')
+      return False
+    self.local.record('hits')
+    return True
+
+  def _lookup_entry(self, build_set):
+    key = self.get_action_key(build_set)
+    data = self._get('ac', key) if key else None
+    if data is None:
+      return None
+    entry = json.loads(data.decode('utf8'))
+    if 'implicit_inputs' in entry:
+      key = self._get_result_key(key, self.restore_paths(entry['implicit_inputs']))
+      data = self._get('ac', key) if key else None
+      if data is None:
+        return None
+      entry = json.loads(data.decode('utf8'))
+    return entry
+
+  def _restore(self, build_set, entry):
+    outputs = entry['outputs']
+    if sorted(outputs) != sorted(build_set.outputs) or \
+        any(len(outputs[k]) != len(v) for k, v in build_set.outputs.items()):
+      return False
+    for set_name, files in sorted(build_set.outputs.items()):
+      for filename, output in zip(files, outputs[set_name]):
+        nr.fs.makedirs(os.path.dirname(filename))
+        if not self._fetch_file(output['digest'], filename, output['executable']):
+          return False
+    depfile = self._get_depfile(build_set)
+    if depfile and entry.get('depfile'):
+      data = self._get('cas', entry['depfile'])
+      if data is None:
+        return False
+      temp = '{}.{}.tmp'.format(depfile, os.getpid())
+      with open(temp, 'w') as fp:
+        fp.write(self.restore_paths(data.decode('utf8')))
+      os.replace(temp, depfile)
+    return True
+
+  def store(self, build_set) -> bool:
+    """
+    Stores the output files of the *build_set* after it was executed.
+    Returns #False if the outputs could not be stored, eg. because one of
+    them or one of the inputs is a directory.
+    """
+
+    files = list(stream.concat(build_set.outputs.values()))
+    if not files or not all(os.path.isfile(x) for x in files):
+      return False
+    key = self.get_action_key(build_set)
+    if not key:
+      return False
+
+    outputs = {}
+    for set_name, files in sorted(build_set.outputs.items()):
+      outputs[set_name] = []
+      for filename in files:
+        digest = file_digest(filename)
+        self._put_file(digest, filename)
+        executable = os.access(filename, os.X_OK) and os.name != 'nt'
+        outputs[set_name].append({'digest': digest, 'executable': executable})
+    entry = {'outputs': outputs}
+
+    depfile = self._get_depfile(build_set)
+    if depfile and os.path.isfile(depfile):
+      implicit_inputs = sorted(set(self._abs(build_set, x) for x in read_depfile(depfile)))
+      with open(depfile) as fp:
+        data = self.relocate(fp.read()).encode('utf8')
+      entry['depfile'] = data_digest(data)
+      self._put('cas', entry['depfile'], data)
+      manifest = {'implicit_inputs': self.relocate(implicit_inputs)}
+      self._put('ac', key, json.dumps(manifest).encode('utf8'))
+      key = self._get_result_key(key, implicit_inputs)
+      if not key:
+        return False
+
+    self._put('ac', key, json.dumps(entry, sort_keys=True).encode('utf8'))
+    return True
@@ -0,0 +1,271 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""
+Detection of undeclared inputs. With `build:audit`, the commands of every
+#BuildSet are executed under a file access tracer, and the files that they
+read are compared with the declared inputs, the entries of the depfile and
+the toolchain roots. Files outside of these were read without being known
+to the build system, thus changing them does not rebuild the build set and
+can produce a stale result (or poison the action cache).
+
+* `build:audit=report` prints the undeclared inputs of every build set
+* `build:audit=record` additionally records them, and the backends treat
+  them as implicit inputs in subsequent builds (the Ninja backend after the
+  build files were exported again, eg. with the next configure step)
+
+The tracer is `strace`, which uses ptrace and requires neither privileges
+nor a preloaded library. It is only available on Linux; on other platforms
+the commands are executed without tracing and a warning is printed.
+
+Files in the system directories (#SYSTEM_ROOTS), the Python installation,
+the `build:toolchainRoots` and the `build:auditIgnore` directories are not
+reported, nor are files that the commands wrote themselves (eg. temporary
+files of the compiler driver). Files in the source and build roots are
+reported even if these are inside a system directory.
+"""
+
+__all__ = ['Tracer', 'get_config', 'parse_trace', 'find_undeclared']
+
+import json
+import nr.fs
+import os
+import re
+import shutil
+import sys
+import tempfile
+
+from nr.stream import Stream as stream
+from typing import Dict, List, Set, Tuple
+from . import dyndep
+from .actioncache import get_path_roots, json_digest, read_depfile
+
+ENVIRON_KEY = 'CRAFTR_AUDIT'
+MODES = ('off', 'report', 'record')
+SYSTEM_ROOTS = ['/bin', '/dev', '/etc', '/lib', '/lib32', '/lib64', '/proc',
+                '/run', '/sbin', '/sys', '/usr']
+# The ? lets strace versions that do not know the system call ignore it.
+TRACED_CALLS = 'open,openat,?openat2,creat,execve'
+WRITE_FLAGS = ('O_WRONLY', 'O_RDWR', 'O_CREAT', 'O_TRUNC')
+
+
+def get_config(options: Dict, build_root: str, build_variant: str) -> Dict:
+  """
+  Returns the configuration of the audit from the session *options*, or
+  #None if `build:audit` is not enabled.
+  """
+
+  mode = str(options.get('build:audit') or 'off').lower()
+  if mode not in MODES:
+    raise ValueError('build:audit must be one of {}'.format(', '.join(MODES)))
+  if mode == 'off':
+    return None
+  ignore = options.get('build:auditIgnore') or []
+  if isinstance(ignore, str):
+    ignore = [x.strip() for x in ignore.split(',') if x.strip()]
+  roots = get_path_roots(options, build_root, always=True)
+  ignore += [v for k, v in roots.items() if k.startswith('TOOLCHAIN')]
+  ignore += [sys.prefix, sys.base_prefix]
+  directory = os.path.join(build_root, 'craftr_audit.{}'.format(build_variant))
+  realpaths = lambda x: sorted(set(os.path.realpath(y) for y in x))
+  return {'mode': mode, 'directory': nr.fs.canonical(directory),
+          'ignore': realpaths(ignore), 'system': realpaths(SYSTEM_ROOTS),
+          'project': realpaths([roots['SOURCE'], roots['BUILD']])}
+
+
+def _unquote(value):
+  return value.encode('latin1').decode('unicode_escape').encode('latin1').decode('utf8', 'replace')
+
+
+def parse_trace(text: str) -> Tuple[Set[str], Set[str]]:
+  """
+  Parses the output of `strace -f -y` and returns the absolute paths of the
+  files that were successfully opened for reading or executed, and of the
+  files that were opened for writing. The paths that strace reports for
+  file descriptors have their symlinks resolved.
+  """
+
+  reads, writes = set(), set()
+  pending = {}
+  for line in text.splitlines():
+    match = re.match(r'(\d+)\s+(.*)$', line)
+    pid, call = match.groups() if match else (None, line)
+    if call.endswith('<unfinished ...>'):
+      pending[pid] = call[:-len('<unfinished ...>')]
+      continue
+    match = re.match(r'<\.\.\. \w+ resumed>(.*)$', call)
+    if match:
+      call = pending.pop(pid, '') + match.group(1)
+    match = re.match(r'(\w+)\((.*)\)\s+=\s+(-?\d+)(?:<(.*)>)?', call)
+    if not match:
+      continue
+    name, args, result, filename = match.groups()
+    if int(result) < 0:
+      continue
+    if name == 'execve':
+      match = re.match(r'"((?:[^"\\]|\\.)*)"', args)
+      if match and os.path.isabs(_unquote(match.group(1))):
+        reads.add(os.path.realpath(_unquote(match.group(1))))
+    elif filename:
+      filename = os.path.normpath(_unquote(filename))
+      if name == 'creat' or any(x in args for x in WRITE_FLAGS):
+        writes.add(filename)
+      else:
+        reads.add(filename)
+  return reads, writes
+
+
+def find_undeclared(reads: Set[str], writes: Set[str], declared: Set[str],
+                    ignore: List[str], system: List[str] = (),
+                    project: List[str] = ()) -> List[str]:
+  """
+  Returns the files in *reads* that are neither *declared*, nor inside one
+  of the *ignore* directories, nor were written by the commands. Files in
+  the *system* directories are ignored too, unless they are inside one of
+  the *project* directories (eg. a workspace in `/usr/src`).
+  """
+
+  prefixes = lambda x: tuple(y.rstrip(os.sep) + os.sep for y in x)
+  ignore, system, project = prefixes(ignore), prefixes(system), prefixes(project)
+  result = []
+  for filename in sorted(reads - writes):
+    if filename in declared or filename.startswith(ignore):
+      continue
+    if filename.startswith(system) and not filename.startswith(project):
+      continue
+    if os.path.isfile(filename):
+      result.append(filename)
+  return result
+
+
+def _get_record_path(directory, build_set):
+  outputs = sorted(stream.concat(build_set.outputs.values()))
+  return os.path.join(directory, json_digest(outputs) + '.json')
+
+
+def get_recorded_inputs(config: Dict, build_set) -> List[str]:
+  """
+  Returns the undeclared inputs that were recorded for *build_set* and that
+  still exist. Ninja would refuse to build with a missing implicit input.
+  """
+
+  if not config or config['mode'] != 'record':
+    return []
+  try:
+    with open(_get_record_path(config['directory'], build_set)) as fp:
+      return [x for x in json.load(fp)['inputs'] if os.path.isfile(x)]
+  except (OSError, ValueError, KeyError):
+    return []
+
+
+class Tracer:
+  """
+  Executes the commands of a #BuildSet under `strace` and reports the files
+  that it read without declaring them.
+  """
+
+  _warned = False
+
+  def __init__(self, config: Dict):
+    self.config = config
+    self.program = shutil.which('strace') if sys.platform.startswith('linux') else None
+    self.logs = []
+    if not self.program and not Tracer._warned:
+      Tracer._warned = True
+      print('warning: build:audit requires strace, commands are not traced', file=sys.stderr)
+
+  def __repr__(self):
+    return 'Tracer(mode={!r})'.format(self.config['mode'])
+
+  @classmethod
+  def from_environ(cls) -> 'Tracer':
+    """
+    Creates a tracer from the configuration that the build backend passed
+    to the process that executes a build set.
+    """
+
+    config = os.environ.get(ENVIRON_KEY)
+    return cls(json.loads(config)) if config else None
+
+  def wrap(self, command: List[str]) -> List[str]:
+    """
+    Returns *command* prefixed so that it is executed under the tracer.
+    """
+
+    if not self.program:
+      return command
+    fd, log = tempfile.mkstemp(suffix='.strace')
+    os.close(fd)
+    self.logs.append(log)
+    return [self.program, '-f', '-qq', '-y', '-e', 'trace=' + TRACED_CALLS,
+            '-o', log, '--'] + list(command)
+
+  def collect(self) -> Tuple[Set[str], Set[str]]:
+    """
+    Parses and removes the logs of the commands that were executed since
+    the last call.
+    """
+
+    reads, writes = set(), set()
+    for log in self.logs:
+      try:
+        with open(log, encoding='latin1') as fp:
+          r, w = parse_trace(fp.read())
+        reads |= r
+        writes |= w
+        os.remove(log)
+      except OSError:
+        pass
+    self.logs = []
+    return reads, writes
+
+  def audit(self, build_set) -> List[str]:
+    """
+    Returns the files that were read by the commands of *build_set* but are
+    neither declared, nor listed in its depfile or dyndep file. In record
+    mode, the files are recorded for #get_recorded_inputs(), and only files
+    that were not recorded before are returned.
+    """
+
+    reads, writes = self.collect()
+    if not self.program:
+      return []
+    outputs = list(stream.concat(build_set.outputs.values()))
+    declared = set(build_set.get_input_files()) | set(outputs)
+    if build_set.depfile and os.path.isfile(build_set.depfile):
+      declared |= set(read_depfile(build_set.depfile))
+    if build_set.dyndep and os.path.isfile(build_set.dyndep):
+      entries = dyndep.load(build_set.dyndep)
+      declared |= set(stream.concat(entries[x].implicit_inputs for x in outputs if x in entries))
+    cwd = build_set.get_cwd() or os.getcwd()
+    declared = set(os.path.realpath(os.path.join(cwd, x)) for x in declared)
+    result = find_undeclared(reads, writes, declared, self.config['ignore'],
+                             self.config.get('system', ()), self.config.get('project', ()))
+    if self.config['mode'] == 'record':
+      previous = set(get_recorded_inputs(self.config, build_set))
+      filename = _get_record_path(self.config['directory'], build_set)
+      nr.fs.makedirs(self.config['directory'])
+      with open(filename, 'w') as fp:
+        json.dump({'outputs': sorted(outputs), 'inputs': result}, fp)
+      result = [x for x in result if x not in previous]
+    return result
@@ -49,6 +49,28 @@ from nr.collections import ChainDict
 from nr.stream import Stream as stream
 from typing import Dict, Iterable, List, Union
 from .template import TemplateCompiler
+from .toolid import ToolIdentityCache
+
+
+def relocate_paths(value, roots: Dict[str, str], restore: bool = False):
+  """
+  Replaces the absolute root directories in *roots*, which maps placeholder
+  names to directories, with `@NAME@` in all strings of *value* (including
+  dictionary keys and nested lists). If *restore* is #True, the
+  placeholders are replaced with the directories instead.
+  """
+
+  if isinstance(value, str):
+    for name, root in sorted(roots.items(), key=lambda x: -len(x[1])):
+      placeholder = '@{}@'.format(name)
+      value = value.replace(placeholder, root) if restore else value.replace(root, placeholder)
+    return value
+  elif isinstance(value, dict):
+    return {relocate_paths(k, roots, restore): relocate_paths(v, roots, restore)
+            for k, v in value.items()}
+  elif isinstance(value, (list, tuple)):
+    return [relocate_paths(x, roots, restore) for x in value]
+  return value
 
 
 class BuildSet:
@@ -62,18 +84,21 @@ class BuildSet:
 
   def __init__(self, master: 'Master', description: str = None,
                environ: Dict[str, str] = None, cwd: str = None,
-               depfile: str = None):
+               depfile: str = None, dyndep: str = None):
     if not isinstance(master, Master):
       raise TypeError('expected Master, got {}'.format(type(master).__name__))
     if description is not None and not isinstance(description, str):
       raise TypeError('expected str, got {}'.format(type(description).__name__))
     if depfile is not None and not isinstance(depfile, str):
       raise TypeError('expected str, got {}'.format(type(depfile).__name__))
+    if dyndep is not None and not isinstance(dyndep, str):
+      raise TypeError('expected str, got {}'.format(type(dyndep).__name__))
     self._master = master
     self.description = description
     self._environ = environ
     self._cwd = cwd or None  # empty string is invalid, fallback to None
     self.depfile = depfile
+    self.dyndep = dyndep
     self._inputs = {}
     self._outputs = {}
     self._variables = {}
@@ -134,12 +159,23 @@ class BuildSet:
 
   def get_input_build_sets(self) -> set:
     inputs = set()
-    for fname in stream.concat(self.inputs.values()):
+    for fname in self.get_input_files():
       bset = self._master._output_files.get(fname, None)
       if bset is not None:
         inputs.add(bset)
     return inputs
 
+  def get_input_files(self) -> List[str]:
+    """
+    Returns a list of all input files of the build set, including the
+    #dyndep file which must be present before the build set can be executed.
+    """
+
+    files = list(stream.concat(self.inputs.values()))
+    if self.dyndep and self.dyndep not in files:
+      files.append(self.dyndep)
+    return files
+
   def get_commands(self):
     """
     Return the expanded commands for the build set from the operator.
@@ -174,7 +210,7 @@ class BuildSet:
   def to_json(self):
     return {'description': self.description, 'environ': self._environ,
             'cwd': self._cwd, 'depfile': self.depfile,
-            'inputs': self._inputs, 'outputs': self._outputs,
+            'dyndep': self.dyndep, 'inputs': self._inputs, 'outputs': self._outputs,
             'variables': self._variables}
 
   @classmethod
@@ -185,6 +221,7 @@ class BuildSet:
     self._environ = data['environ']
     self._cwd = data['cwd']
     self.depfile = data['depfile']
+    self.dyndep = data.get('dyndep')
     self._inputs = data['inputs']
     self._outputs = data['outputs']
     self._variables = data['variables']
@@ -193,15 +230,22 @@ class BuildSet:
     [master._declare_output(self, x) for x in stream.concat(self.outputs.values())]
     return self
 
-  def compute_hash(self):
+  def compute_hash(self, path_roots: Dict[str, str] = None):
     """
-    Computes a hash for the build set.
+    Computes a hash for the build set. If *path_roots* is specified, the
+    root directories are replaced with placeholders before hashing (see
+    #relocate_paths()), so that the hash is the same for another checkout
+    in a different location.
     """
 
     data = self.to_json()
     data['commands'] = self.operator.commands.to_json()
     data['environ'] = dict(self.get_environ())
     data['cwd'] = self.get_cwd()
+    if self.operator.tool_identity:
+      data['tool'] = self.operator.tool_identity
+    if path_roots:
+      data = relocate_paths(data, path_roots)
     return hashlib.sha1(json.dumps(data, sort_keys=True).encode('utf8')).hexdigest()
 
 
@@ -359,7 +403,9 @@ class Operator:
                environ: Dict[str, str] = None, cwd: str = None,
                explicit: bool = False, syncio: bool = False,
                deps_prefix: str = None, restat: bool = False,
-               run_always: bool = False):
+               run_always: bool = False, pool: str = None,
+               cacheable: bool = False, early_cutoff: bool = None,
+               tool: str = None):
 
     if not isinstance(master, Master):
       raise TypeError('expected Master, got {}'.format(type(master).__name__))
@@ -371,6 +417,10 @@ class Operator:
       raise TypeError('expected Commands, got {}'.format(type(commands).__name__))
     if deps_prefix is not None and not isinstance(deps_prefix, str):
       raise TypeError('expected str, got {}'.format(type(deps_prefix).__name__))
+    if pool is not None and not isinstance(pool, str):
+      raise TypeError('expected str, got {}'.format(type(pool).__name__))
+    if tool is not None and not isinstance(tool, str):
+      raise TypeError('expected str, got {}'.format(type(tool).__name__))
     self._name = name
     self._master = master
     self._commands = commands
@@ -384,6 +434,11 @@ class Operator:
     self._deps_prefix = deps_prefix
     self._restat = restat
     self._run_always = run_always
+    self._pool = pool
+    self._cacheable = cacheable
+    self._early_cutoff = early_cutoff
+    self._tool = tool
+    self._tool_identity = master.tool_identities.get(tool, environ) if tool else None
 
   def __repr__(self):
     return 'Operator(target={!r}, name={!r}))'.format(self._target, self._name)
@@ -440,6 +495,57 @@ class Operator:
   def run_always(self):
     return self._run_always
 
+  @property
+  def pool(self):
+    """
+    The name of the pool that limits the number of build sets of this
+    operator that may be executed concurrently. The pool must be declared
+    with #Master.add_pool().
+    """
+
+    return self._pool
+
+  @property
+  def cacheable(self):
+    """
+    #True if the build sets of this operator are deterministic given their
+    inputs, allowing their outputs to be taken from an action cache (see
+    #craftr.core.actioncache).
+    """
+
+    return self._cacheable
+
+  @property
+  def early_cutoff(self):
+    """
+    #True if the timestamps of the output files that did not change when the
+    build set was executed are restored, so that the build sets depending on
+    them are not executed again (see #craftr.core.cutoff). Defaults to
+    #run_always, as these operators usually reproduce the same outputs.
+    """
+
+    if self._early_cutoff is None:
+      return self._run_always
+    return self._early_cutoff
+
+  @property
+  def tool(self):
+    """
+    The name or path of the program that the commands of this operator
+    execute, eg. the compiler. Its identity is included in the hash of the
+    build sets (see #craftr.core.toolid).
+    """
+
+    return self._tool
+
+  @property
+  def tool_identity(self):
+    """
+    The identity of the #tool when the operator was created, or #None.
+    """
+
+    return self._tool_identity
+
   @property
   def build_sets(self):
     return self._build_sets[:]
@@ -476,7 +582,11 @@ class Operator:
             'build_sets': [x.to_json() for x in build_sets],
             'variables': self._variables, 'environ': self._environ,
             'cwd': self._cwd, 'explicit': self._explicit,
-            'syncio': self._syncio, 'deps_prefix': self._deps_prefix}
+            'syncio': self._syncio, 'deps_prefix': self._deps_prefix,
+            'restat': self._restat, 'run_always': self._run_always,
+            'pool': self._pool, 'cacheable': self._cacheable,
+            'early_cutoff': self._early_cutoff, 'tool': self._tool,
+            'tool_identity': self._tool_identity}
 
   @classmethod
   def from_json(cls, master: 'Master', target: 'Target', data: Dict):
@@ -492,6 +602,13 @@ class Operator:
     self._explicit = data['explicit']
     self._syncio = data['syncio']
     self._deps_prefix = data['deps_prefix']
+    self._restat = data.get('restat', False)
+    self._run_always = data.get('run_always', False)
+    self._pool = data.get('pool')
+    self._cacheable = data.get('cacheable', False)
+    self._early_cutoff = data.get('early_cutoff')
+    self._tool = data.get('tool')
+    self._tool_identity = data.get('tool_identity')
     return self
 
 
@@ -567,6 +684,8 @@ class Master:
     self._template_compiler = template_compiler or TemplateCompiler()
     self._targets = {}
     self._output_files = {}  # Maps from the canonical filename to a BuildSet
+    self._pools = {}  # Maps from the pool name to its depth
+    self.tool_identities = ToolIdentityCache()
 
   @property
   def template_compiler(self):
@@ -593,6 +712,23 @@ class Master:
     self._targets[target._id] = target
     return target
 
+  @property
+  def pools(self):
+    return dict(self._pools)
+
+  def add_pool(self, name, depth):
+    """
+    Declares a pool that limits the number of concurrently executed build
+    sets of all operators that reference the pool to *depth*. Declaring the
+    same pool again updates its depth.
+    """
+
+    if not isinstance(name, str):
+      raise TypeError('expected str, got {}'.format(type(name).__name__))
+    if not isinstance(depth, int) or depth < 1:
+      raise ValueError('pool depth must be a positive integer')
+    self._pools[name] = depth
+
   def _declare_output(self, build_set:BuildSet, filename:str):
     # Note: filename must be canonicalized
     assert self.canonicalize_path(filename) == filename
@@ -0,0 +1,95 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""
+Early cutoff for the build sets of operators with #Operator.early_cutoff.
+The digests and timestamps of the existing output files are recorded with
+an #OutputSnapshot before the commands are executed. Afterwards, every
+output that has the same content as before gets its old timestamp back,
+thus the build sets that consume it are not considered out of date: Ninja
+rechecks the timestamps of the outputs of such operators (`restat`), and
+the Python backend compares the timestamps of the inputs and outputs.
+
+The timestamps of an operator's own outputs are older than its inputs after
+a cutoff. Ninja records the time of the newest input in its build log in that
+case, the Python backend stores it in its build log with #newest_mtime().
+"""
+
+__all__ = ['OutputSnapshot', 'newest_mtime']
+
+import os
+
+from nr.stream import Stream as stream
+from typing import List
+from .actioncache import file_digest
+
+
+def newest_mtime(filenames: List[str]) -> float:
+  """
+  Returns the timestamp of the most recently modified file in *filenames*,
+  ignoring files that do not exist. Returns 0 if none of the files exist.
+  """
+
+  result = 0
+  for filename in filenames:
+    try:
+      result = max(result, os.path.getmtime(filename))
+    except OSError:
+      pass
+  return result
+
+
+class OutputSnapshot:
+  """
+  Records the content digest and the timestamps of the output files of a
+  #BuildSet that exist before its commands are executed.
+  """
+
+  def __init__(self, build_set):
+    self.files = {}
+    for filename in stream.concat(build_set.outputs.values()):
+      try:
+        st = os.stat(filename)
+        if os.path.isfile(filename):
+          self.files[filename] = (file_digest(filename), st.st_atime_ns, st.st_mtime_ns)
+      except OSError:
+        pass
+
+  def __repr__(self):
+    return 'OutputSnapshot(files={!r})'.format(list(self.files))
+
+  def restore_unchanged(self) -> List[str]:
+    """
+    Restores the timestamps of the output files that have the same content
+    as when the snapshot was taken. Returns the names of these files.
+    """
+
+    result = []
+    for filename, (digest, atime, mtime) in self.files.items():
+      try:
+        if file_digest(filename) == digest:
+          os.utime(filename, ns=(atime, mtime))
+          result.append(filename)
+      except OSError:
+        pass
+    return result
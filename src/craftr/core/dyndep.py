@@ -0,0 +1,146 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+"""
+Reading and writing of dynamic dependency files. The format is that of
+Ninja's dyndep files (https://ninja-build.org/manual.html#ref_dyndep), which
+allows the Ninja backend to consume the files directly while other backends
+can use #load() to discover the additional dependencies of a #BuildSet that
+only become known during the build.
+
+```
+ninja_dyndep_version = 1
+build out | implicit_outputs: dyndep | implicit_inputs
+```
+"""
+
+__all__ = ['Entry', 'load', 'loads', 'dump', 'dumps']
+
+import collections
+import io
+import nr.fs
+
+from typing import Dict, List
+
+Entry = collections.namedtuple('Entry', 'implicit_inputs implicit_outputs')
+
+
+def _escape(path):
+  return path.replace('$', '$$').replace(' ', '$ ').replace(':', '$:')
+
+
+def _split(line):
+  """
+  Splits a line of a dyndep file into its path components, respecting the
+  Ninja escape sequences.
+  """
+
+  result = []
+  current = ''
+  escape = False
+  for char in line:
+    if escape:
+      current += char
+      escape = False
+    elif char == '$':
+      escape = True
+    elif char == ' ':
+      if current:
+        result.append(current)
+      current = ''
+    elif char in ':|':
+      if current:
+        result.append(current)
+      result.append(char)
+      current = ''
+    else:
+      current += char
+  if current:
+    result.append(current)
+  return result
+
+
+def loads(text: str) -> Dict[str, Entry]:
+  """
+  Parses the contents of a dyndep file and returns a dictionary that maps
+  the explicit output of every build statement to an #Entry.
+  """
+
+  result = {}
+  for lineno, line in enumerate(text.splitlines(), 1):
+    line = line.strip()
+    if not line or line.startswith('#'):
+      continue
+    if line.startswith('ninja_dyndep_version'):
+      version = line.partition('=')[2].strip()
+      if version not in ('1', '1.0'):
+        raise ValueError('line {}: unsupported dyndep version {!r}'.format(lineno, version))
+      continue
+    if not line.startswith('build '):
+      continue  # Variable bindings, eg. restat = 1
+    parts = _split(line[6:])
+    colon = parts.index(':')
+    outputs, inputs = parts[:colon], parts[colon+1:]
+    if not inputs or inputs[0] != 'dyndep':
+      raise ValueError('line {}: expected "dyndep" rule'.format(lineno))
+    inputs = inputs[1:]
+    if '|' in outputs:
+      outputs, implicit_outputs = outputs[:outputs.index('|')], outputs[outputs.index('|')+1:]
+    else:
+      implicit_outputs = []
+    if inputs and inputs[0] == '|':
+      inputs = inputs[1:]
+    if len(outputs) != 1:
+      raise ValueError('line {}: expected exactly one explicit output'.format(lineno))
+    result[outputs[0]] = Entry(inputs, implicit_outputs)
+  return result
+
+
+def load(filename: str) -> Dict[str, Entry]:
+  with open(filename) as fp:
+    return loads(fp.read())
+
+
+def dumps(entries: Dict[str, Entry]) -> str:
+  fp = io.StringIO()
+  fp.write('ninja_dyndep_version = 1\n')
+  for output, entry in sorted(entries.items()):
+    line = 'build ' + _escape(output)
+    if entry.implicit_outputs:
+      line += ' | ' + ' '.join(map(_escape, entry.implicit_outputs))
+    line += ': dyndep'
+    if entry.implicit_inputs:
+      line += ' | ' + ' '.join(map(_escape, entry.implicit_inputs))
+    fp.write(line + '\n')
+  return fp.getvalue()
+
+
+def dump(entries: Dict[str, Entry], filename: str):
+  """
+  Writes the dyndep *entries* to *filename*. The file is only touched if
+  its contents changed, so that consumers are not rebuilt needlessly.
+  """
+
+  with nr.fs.mtime_consistent_file(filename, 'w') as fp:
+    fp.write(dumps(entries))
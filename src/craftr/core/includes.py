@@ -0,0 +1,158 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+"""
+The include graph of the compiled sources, as analyzed by the
+`include-report` tool. The include sets of the sources are complete (they
+come from the compiler), the edges between the headers are determined by
+scanning the headers and matching the included names against the known
+headers.
+"""
+
+__all__ = ['Unit', 'IncludeGraph', 'rank_by_parse_cost', 'pch_candidates']
+
+import collections
+import os
+import re
+
+from typing import List
+
+INCLUDE_REGEX = re.compile(r'^\s*#\s*(?:include|import)\s*[<"]([^>"]+)[>"]', re.M)
+
+
+class Unit:
+  """
+  A compiled source of the *target* and the *headers* that it includes.
+  """
+
+  def __init__(self, target: str, src: str, obj: str, headers: List[str]):
+    self.target = target
+    self.src = src
+    self.obj = obj
+    self.headers = headers
+
+  def __repr__(self):
+    return 'Unit(target={!r}, src={!r})'.format(self.target, self.src)
+
+
+class IncludeGraph:
+  """
+  The headers included by the compiled *units*. #fan_in counts the units
+  that include each header.
+  """
+
+  def __init__(self, units: List[Unit]):
+    self.units = units
+    self.fan_in = collections.Counter()
+    self.by_name = collections.defaultdict(list)
+    for unit in units:
+      self.fan_in.update(unit.headers)
+    for header in self.fan_in:
+      self.by_name[os.path.basename(header)].append(header)
+    self._lines = {}
+    self._edges = {}
+    self._closure = {}
+
+  def lines(self, header: str) -> int:
+    if header not in self._lines:
+      try:
+        with open(header, 'rb') as fp:
+          self._lines[header] = fp.read().count(b'\n')
+      except OSError:
+        self._lines[header] = 0
+    return self._lines[header]
+
+  def edges(self, header: str) -> List[str]:
+    """
+    Returns the known headers that *header* includes. An included name that
+    matches multiple headers resolves to the one in the same directory, or
+    else to the first one.
+    """
+
+    if header not in self._edges:
+      try:
+        with open(header, encoding='utf8', errors='replace') as fp:
+          names = INCLUDE_REGEX.findall(fp.read())
+      except OSError:
+        names = []
+      result = []
+      for name in names:
+        name = name.replace('\\', '/')
+        candidates = [x for x in self.by_name.get(name.rpartition('/')[2], [])
+                      if x.replace('\\', '/').endswith('/' + name) and x != header]
+        local = [x for x in candidates if os.path.dirname(x) == os.path.dirname(header)]
+        result += (local or candidates)[:1]
+      self._edges[header] = result
+    return self._edges[header]
+
+  def closure(self, header: str) -> set:
+    """
+    Returns *header* and all the headers that it includes transitively.
+    """
+
+    if header not in self._closure:
+      result, stack = set(), [header]
+      while stack:
+        current = stack.pop()
+        if current not in result:
+          result.add(current)
+          stack += self.edges(current)
+      self._closure[header] = result
+    return self._closure[header]
+
+  def transitive_lines(self, header: str) -> int:
+    return sum(self.lines(x) for x in self.closure(header))
+
+
+def rank_by_parse_cost(graph: IncludeGraph) -> List[tuple]:
+  """
+  Returns pairs of the headers and their parse cost, which is the number
+  of units that include the header times the lines of its closure, with
+  the most expensive headers first.
+  """
+
+  costs = {x: n * graph.transitive_lines(x) for x, n in graph.fan_in.items()}
+  return sorted(costs.items(), key=lambda x: (-x[1], x[0]))
+
+
+def pch_candidates(graph: IncludeGraph, units: List[Unit], threshold: float,
+                   top: int = None) -> List[str]:
+  """
+  Returns the headers that are suggested for a precompiled header of the
+  *units* of one target: headers that at least the *threshold* fraction of
+  the units include, the most expensive to parse first. Headers that a
+  better candidate includes anyway are left out.
+  """
+
+  counts = collections.Counter()
+  for unit in units:
+    counts.update(unit.headers)
+  candidates = [x for x, n in counts.items() if n >= threshold * len(units)]
+  candidates.sort(key=lambda x: (-counts[x] * graph.transitive_lines(x), x))
+  covered = set()
+  result = []
+  for header in candidates:
+    if header in covered or (top is not None and len(result) >= top):
+      continue
+    covered |= graph.closure(header)
+    result.append(header)
+  return result
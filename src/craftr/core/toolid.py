@@ -0,0 +1,145 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""
+Identities of the tools that operators execute (see #Operator.tool). The
+#BuildSet.compute_hash() covers the command lines, but not which binary the
+program name resolves to. The identity of a tool consists of the resolved
+path, the size and the first line of its `--version` output, plus the
+digest of its contents if it is smaller than #MAX_DIGEST_SIZE (eg. a
+compiler driver or a script). After a compiler upgrade, the identity
+changes, thus the build sets are executed again and the action cache does
+not serve objects from the old compiler.
+
+Running the tool to get its version is slow, thus the identities are cached
+in a #ToolIdentityCache and only recomputed when the modification time or
+the inode of the binary changes.
+"""
+
+__all__ = ['MAX_DIGEST_SIZE', 'ToolIdentityCache', 'resolve_tool']
+
+import hashlib
+import json
+import nr.fs
+import os
+import shutil
+import subprocess
+import sys
+
+from typing import Dict
+
+MAX_DIGEST_SIZE = 16 * 1024 * 1024
+VERSION_TIMEOUT = 10
+
+
+def resolve_tool(program: str, environ: Dict[str, str] = None) -> str:
+  """
+  Returns the absolute path that *program* resolves to with the `PATH` in
+  *environ* (or the current environment), or #None. Symlinks are not
+  resolved, as some programs behave differently depending on their name
+  (eg. ccache).
+  """
+
+  search_path = (environ or {}).get('PATH') or os.environ.get('PATH')
+  program = shutil.which(program, path=search_path)
+  return os.path.abspath(program) if program else None
+
+
+def get_version(program: str) -> str:
+  """
+  Returns the first line that the *program* prints with `--version`, or
+  #None. Tools that do not know the option usually still print a banner
+  with their version (eg. MSVC).
+  """
+
+  try:
+    output = subprocess.run([program, '--version'], stdin=subprocess.DEVNULL,
+      stdout=subprocess.PIPE, stderr=subprocess.STDOUT, timeout=VERSION_TIMEOUT).stdout
+  except (OSError, subprocess.SubprocessError):
+    return None
+  lines = output.decode('utf8', 'replace').splitlines()
+  return next((x.strip() for x in lines if x.strip()), None)
+
+
+def compute_identity(program: str) -> Dict:
+  filename = os.path.realpath(program)
+  size = os.path.getsize(filename)
+  if size <= MAX_DIGEST_SIZE:
+    hasher = hashlib.sha256()
+    with open(filename, 'rb') as fp:
+      for chunk in iter(lambda: fp.read(1 << 16), b''):
+        hasher.update(chunk)
+    digest = hasher.hexdigest()
+  else:
+    digest = None
+  return {'path': filename, 'size': size, 'version': get_version(program), 'digest': digest}
+
+
+class ToolIdentityCache:
+  """
+  Caches the identities of tools by their resolved path. If *filename* is
+  specified, the cache is persistent between invocations of Craftr.
+  """
+
+  def __init__(self, filename: str = None):
+    self.filename = filename
+    self.data = {}
+    self.changed = False
+    if filename:
+      try:
+        with open(filename) as fp:
+          self.data = json.load(fp)
+      except FileNotFoundError:
+        pass
+      except ValueError as exc:
+        print('warning: error loading tool identities "{}": {}'.format(filename, exc), file=sys.stderr)
+
+  def __repr__(self):
+    return 'ToolIdentityCache(filename={!r})'.format(self.filename)
+
+  def get(self, program: str, environ: Dict[str, str] = None) -> Dict:
+    """
+    Returns the identity of *program*, or #None if it can not be found.
+    """
+
+    program = resolve_tool(program, environ)
+    if not program:
+      return None
+    try:
+      st = os.stat(program)
+    except OSError:
+      return None
+    entry = self.data.get(program)
+    if not entry or entry['mtime'] != st.st_mtime_ns or entry['inode'] != st.st_ino:
+      entry = {'mtime': st.st_mtime_ns, 'inode': st.st_ino, 'identity': compute_identity(program)}
+      self.data[program] = entry
+      self.changed = True
+    return entry['identity']
+
+  def save(self):
+    if not self.filename or not self.changed:
+      return
+    nr.fs.makedirs(nr.fs.dir(self.filename))
+    with open(self.filename, 'w') as fp:
+      json.dump(self.data, fp)
+    self.changed = False
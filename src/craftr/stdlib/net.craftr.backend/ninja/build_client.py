@@ -42,7 +42,7 @@ import subprocess
 import sys
 
 from nr.stream import Stream as stream
-from craftr.core import build
+from craftr.core import actioncache, audit, build, cutoff
 from craftr.utils.sh import quote
 
 verbose = os.environ.get('CRAFTR_VERBOSE') == 'true'
@@ -147,9 +147,30 @@ def main(argv=None, prog=None):
   if cwd:
     os.chdir(cwd)
 
+  # Remember the current outputs to restore the timestamps of those that
+  # do not change, which lets Ninja skip the dependent build sets (restat).
+  snapshot = cutoff.OutputSnapshot(bset) if operator.early_cutoff else None
+
+  # Take the output files from the action cache if the build set was
+  # executed with the same inputs before.
+  cache = None
+  if operator.cacheable and not additional_args:
+    cache = actioncache.ActionCache.from_environ()
+  if cache and cache.lookup(bset):
+    if verbose:
+      print('note: "{}" taken from the action cache'.format(operator.id))
+    if snapshot:
+      snapshot.restore_unchanged()
+    return 0
+  if cache:
+    cache.prepare(bset)
+
   # Generate the command list.
   commands = bset.get_commands()
 
+  # Trace the files that the commands read with build:audit.
+  tracer = audit.Tracer.from_environ()
+
   # Used to print the command-list on failure.
   def print_command_list(current=-1):
     if cwd:
@@ -170,11 +191,13 @@ def main(argv=None, prog=None):
       if i == len(commands) - 1:
         cmd = cmd + additional_args
       try:
-        code = subprocess.call(cmd)
+        code = subprocess.call(tracer.wrap(cmd) if tracer else cmd)
       except OSError as e:
         error(e)
         code = 127
       if code != 0:
+        if tracer:
+          tracer.collect()
         error('\n' + '-'*60)
         error('fatal: "{}" exited with code {}.'.format(operator.id, code))
         print_command_list(i)
@@ -196,6 +219,20 @@ def main(argv=None, prog=None):
     error('-'*60 + '\n')
     return 1
 
+  if tracer:
+    undeclared = tracer.audit(bset)
+    if undeclared:
+      error('warning: "{}" read {} undeclared input(s):'.format(operator.id, len(undeclared)))
+      for x in undeclared:
+        error('  -', x)
+
+  if cache:
+    cache.store(bset)
+  if snapshot:
+    unchanged = snapshot.restore_unchanged()
+    if verbose and unchanged:
+      print('note: "{}" did not change {} output file(s)'.format(operator.id, len(unchanged)))
+
   """
   # TODO: Optional output files ..? Currently not supported in the BuildSet
   # Show a warning about missing optional output files.
@@ -1,10 +1,21 @@
 
 import {options} from '../build.craftr'
+import collections
+import fnmatch
+import hashlib
+import json
 import nr.fs
+import os
+import re
+import shutil
+import sys
 
 from craftr.api import *
 from craftr.core import build
+from craftr.core.actioncache import get_path_roots
 from craftr.core.template import TemplateCompiler
+from craftr.utils import sh
+from craftr.utils.maps import ObjectAsDict, ObjectFromDict
 from dataclasses import dataclass
 from typing import List, Dict, Union, Callable
 from nr.stream import Stream as stream
@@ -53,6 +64,148 @@ def is_staticlib(data):
   return data.type == 'library' and data.preferredLinkage == 'static'
 
 
+# Memory allocators for cxx.allocator, mapped to their pkg-config package
+# and library name.
+ALLOCATORS = {
+  'jemalloc': ('jemalloc', 'jemalloc'),
+  'mimalloc': ('mimalloc', 'mimalloc'),
+  'tcmalloc': ('libtcmalloc', 'tcmalloc')
+}
+
+
+# Properties that can be overridden per source file with cxx.sourceOverrides.
+# List properties are extended, all others are replaced.
+SOURCE_OVERRIDE_KEYS = ('compilerFlags', 'defines', 'optimization', 'cStd',
+                        'cppStd', 'treatWarningsAsErrors', 'warningLevel')
+
+
+def match_source_overrides(data, src):
+  """
+  Returns the patterns in `cxx.sourceOverrides` that match *src*.
+  """
+
+  return tuple(x for x in data.sourceOverrides if fnmatch.fnmatch(src, x))
+
+
+def apply_source_overrides(data, patterns):
+  """
+  Returns a copy of the target's cxx *data* with the `cxx.sourceOverrides`
+  of the specified *patterns* applied.
+  """
+
+  result = ObjectFromDict(dict(ObjectAsDict(data)))
+  for pattern in patterns:
+    for key, value in data.sourceOverrides[pattern].items():
+      if key not in SOURCE_OVERRIDE_KEYS:
+        error('invalid key in cxx.sourceOverrides[{!r}]: {!r}'.format(pattern, key))
+      if isinstance(getattr(result, key), list):
+        value = getattr(result, key) + ([value] if isinstance(value, str) else list(value))
+      setattr(result, key, value)
+  return result
+
+
+# File suffixes that identify C++20 module interface units.
+MODULE_INTERFACE_SUFFIXES = ('.cppm', '.ixx', '.mpp', '.mxx', '.c++m')
+
+COLLATE_MODULES_TOOL = path.join(path.dir(path.dir(__file__)), 'tools', 'collate_modules.py')
+PGO_PROFILE_TOOL = path.join(path.dir(path.dir(__file__)), 'tools', 'pgo_profile.py')
+REPLACE_IF_CHANGED_TOOL = path.join(path.dir(path.dir(__file__)), 'tools', 'replace_if_changed.py')
+INTERFACE_STUB_TOOL = path.join(path.dir(path.dir(__file__)), 'tools', 'interface_stub.py')
+
+
+def is_module_interface(filename):
+  return filename.endswith(MODULE_INTERFACE_SUFFIXES)
+
+
+# Maps the ID of targets that provide C++20 modules to the key of the flags
+# that their BMIs were compiled with and their collated modules JSON file.
+# Used to share BMIs with dependent targets.
+_module_providers = {}
+
+# Maps the keys from #Compiler.get_shared_object_key() to the object file
+# in the shared object directory (see #Compiler.get_shared_object_directory()).
+_shared_objects = {}
+
+
+class ModuleInfo:
+  """
+  Created by #Compiler.create_module_actions() and stored in the `_modules`
+  member of the target's cxx data. Consumed by #Compiler.create_compile_action()
+  to connect the compile build sets with the collated module information.
+  """
+
+  def __init__(self, directory, bmi_suffix):
+    self.directory = directory
+    self.bmi_suffix = bmi_suffix
+    self.dyndep = path.join(directory, 'modules.dd')
+    self.modules_json = path.join(directory, 'modules.json')
+    self.header_unit_dir = path.join(directory, 'header-units')
+    self.header_unit_mapper = None
+    self.header_units = {}  # Maps header name to BMI (or stamp) file.
+
+  def get_modmap(self, obj):
+    return obj + '.modmap'
+
+  def get_bmi(self, obj):
+    return path.setsuffix(obj, self.bmi_suffix)
+
+  def add_to_build_set(self, bset, interface):
+    obj = bset.outputs['obj'][0]
+    bset.add_input_files('modmap', [self.get_modmap(obj)])
+    if self.header_units:
+      bset.add_input_files('?header-units', list(self.header_units.values()))
+    if interface:
+      bset.add_output_files('bmi', [self.get_bmi(obj)])
+    bset.dyndep = self.dyndep
+
+
+# CPU features that are checked at runtime to select the x86-64
+# microarchitecture levels in cxx.isaVariants. Other variants are
+# checked with `__builtin_cpu_is()`.
+ISA_LEVEL_FEATURES = {
+  'x86-64-v2': ['sse4.2', 'popcnt'],
+  'x86-64-v3': ['avx2', 'fma', 'bmi2'],
+  'x86-64-v4': ['avx512f', 'avx512bw', 'avx512dq', 'avx512vl']
+}
+
+
+def parse_function_decl(decl):
+  """
+  Parses a C function declaration as specified in `cxx.isaFunctions` and
+  returns a tuple of the return type, name, parameters and the list of
+  parameter names.
+  """
+
+  match = re.match(r'^\s*(.*?)\b([A-Za-z_]\w*)\s*\((.*)\)\s*;?\s*$', decl, re.S)
+  if not match:
+    error('invalid function declaration in cxx.isaFunctions: {!r}'.format(decl))
+  ret, name, params = match.groups()
+  names = []
+  for param in filter(None, (x.strip() for x in params.split(','))):
+    if param in ('void', '...'):
+      continue
+    if '(' in param:
+      error('function pointer parameters in cxx.isaFunctions must use a '
+            'typedef: {!r}'.format(decl))
+    names.append(re.findall(r'[A-Za-z_]\w*', param)[-1])
+  return ret.strip(), name, params.strip(), names
+
+
+def get_isa_suffix(variant):
+  return re.sub(r'\W', '_', variant) if variant else 'default'
+
+
+def strip_args(command, args):
+  """
+  Removes the first contiguous occurrence of *args* from *command*.
+  """
+
+  for i in range(len(command) - len(args) + 1):
+    if command[i:i+len(args)] == args:
+      return command[:i] + command[i+len(args):]
+  return command
+
+
 @datamodel
 class Compiler:
   """
@@ -106,9 +259,84 @@ class Compiler:
   save_temps: List[str]               # Flags to save temporary files during the compilation step.
   depfile_args: List[str] = field(default_factory=list)  # Arguments to enable writing a depfile or producing output for deps_prefix.
   depfile_name: str = None             # The deps filename. Usually, this would contain the variable $out.
+  compiler_response_file: List[str] = field(default_factory=list)  # Flag(s) to read arguments from a response file.
   deps_prefix: str = None              # The deps prefix (don't mix with depfile_name).
   use_framework: str = None
 
+  # C++20 modules settings. Toolchains that support modules must also
+  # implement #get_module_scan_command() and #get_header_unit_commands().
+  modules_supported: bool = False
+  modules_flag: List[str] = field(default_factory=list)            # Flag(s) to enable C++20 modules.
+  modules_interface_flag: List[str] = field(default_factory=list)  # Flag(s) that precede a module interface source.
+  modules_output_flag: List[str] = field(default_factory=list)     # Flag(s) to specify the BMI output file.
+  modules_mapper_flag: List[str] = field(default_factory=list)     # Flag(s) to pass the module map file.
+  modules_mapper_format: str = None                                # Either `gcc` (module mapper) or `clang` (response file).
+  modules_bmi_suffix: str = None
+
+  # Link-time optimization settings. The flags are mapped by the cxx.lto
+  # mode (`full` or `thin`), modes that are missing are not supported.
+  lto_compile_flags: Dict[str, List[str]] = field(default_factory=dict)
+  lto_link_flags: Dict[str, List[str]] = field(default_factory=dict)
+  lto_jobs_flag: List[str] = field(default_factory=list)   # Flag(s) to specify the number of LTO backend jobs.
+  lto_cache_flag: List[str] = field(default_factory=list)  # Flag(s) to specify the ThinLTO cache directory.
+  lto_archiver: List[str] = None                           # Archiver that preserves LTO objects (defaults to #archiver).
+
+  # Profile-guided optimization settings.
+  pgo_generate_flag: List[str] = field(default_factory=list)   # Flag(s) to instrument the code (%ARG% is the raw profile directory).
+  pgo_use_flag: List[str] = field(default_factory=list)        # Flag(s) to optimize with a profile (%ARG% is the profile).
+  pgo_prefix_flag: List[str] = field(default_factory=list)     # Flag(s) to strip the object directory from profile data names.
+  pgo_merge: List[str] = None                                   # Command to merge raw profiles, if the compiler needs it.
+  pgo_train_env: Dict[str, str] = field(default_factory=dict)  # Environment for the training run (%ARG% is the raw profile directory).
+
+  # Flags for cxx.discardUnusedData and cxx.identicalCodeFolding. The ICF
+  # flag receives the mode (`safe` or `all`) as %ARG%. If #icf_linkers is
+  # set, ICF is only supported with these cxx.linker values.
+  discard_unused_compile_flag: List[str] = field(default_factory=list)
+  discard_unused_link_flag: List[str] = field(default_factory=list)
+  icf_flag: List[str] = field(default_factory=list)
+  icf_linkers: List[str] = None
+
+  # Symbol visibility and export settings. The inlines flag is only used
+  # for C++ sources.
+  visibility_hidden_flag: List[str] = field(default_factory=list)
+  visibility_inlines_hidden_flag: List[str] = field(default_factory=list)
+  export_attribute: str = ''                # Value of cxx.exportMacro when building a shared library.
+  import_attribute: str = ''                # Value of cxx.exportMacro for users of a shared library.
+  export_map_flag: List[str] = field(default_factory=list)
+  symbolic_functions_flag: List[str] = field(default_factory=list)
+  bind_now_flag: List[str] = field(default_factory=list)
+  hash_style_flag: List[str] = field(default_factory=list)
+
+  # Post-link optimization with BOLT (see #create_bolt_actions()).
+  bolt_link_flag: List[str] = field(default_factory=list)  # Flag(s) to keep relocations in the linked binary.
+  bolt_optimize_flags: List[str] = field(default_factory=list)
+  llvm_bolt: List[str] = None
+  perf2bolt: List[str] = None
+  perf: List[str] = None
+
+  # Flag(s) for cxx.timeTrace. If the compiler writes the trace to a file
+  # next to the object file, the suffix of that file must be specified, as
+  # it is collected as an output of the build set. Otherwise the report is
+  # only printed to the build log.
+  time_trace_flag: List[str] = field(default_factory=list)
+  time_trace_suffix: str = None
+
+  # Flag to rewrite a directory prefix in the paths that are embedded in
+  # the object file (eg. debug information and __FILE__). Used to make the
+  # objects independent of the checkout location with build:relocatableKeys.
+  file_prefix_map_flag: List[str] = field(default_factory=list)
+
+  # Flags for build:reproducible, in addition to the #file_prefix_map_flag.
+  reproducible_compile_flags: List[str] = field(default_factory=list)
+  reproducible_link_flags: List[str] = field(default_factory=list)
+
+  # True if the compile commands can be run through the dist-compile tool
+  # (see the cxx:distribute option), which only knows GCC compatible drivers.
+  supports_distributed_compile: bool = False
+
+  # Flag(s) to compile for one of the cxx.isaVariants.
+  isa_flag: List[str] = field(default_factory=list)
+
   # OpenMP settings.
   compiler_supports_openmp: bool = False
   compiler_enable_openmp: List[str] = None
@@ -127,11 +355,33 @@ class Compiler:
   # Non-existing keys will have appropriate default values.
   linker_runtime: Dict[str, Dict[str, List[str]]] = field(default_factory=dict)
 
-  # XXX support MSVC /WHOLEARCHIVE
+  # Linkers that can be selected with cxx.linker. The threads flag is mapped
+  # by the linker name, %ARG% is the number of threads.
+  linkers: List[str] = field(default_factory=list)
+  linker_select_flag: List[str] = field(default_factory=list)
+  linker_threads_flag: Dict[str, List[str]] = field(default_factory=dict)
+
+  # Dependent targets link with shared libraries directly (instead of an
+  # import library). The interface stub command prints the symbols that a
+  # shared library (%ARG%) exports in the #interface_stub_format (`nm` or
+  # `text`), see #create_interface_stub_action().
+  link_shared_libraries: bool = True
+  interface_stub: List[str] = None
+  interface_stub_format: str = 'text'
+
+  # Flags to link all members of a static library (%ARG% is the library),
+  # and flags that keep the linker from dropping the shared libraries that
+  # follow them, eg. because of `--as-needed`. Used for cxx.allocator.
+  whole_archive_flag: List[str] = field(default_factory=list)
+  keep_libraries_begin_flag: List[str] = field(default_factory=list)
+  keep_libraries_end_flag: List[str] = field(default_factory=list)
 
   archiver: List[str]                 # Arguments to invoke the archiver.
   archiver_env: List[str]             # Environment variables for the archiver.
   archiver_out: List[str]             # Flag(s) to specify the output file.
+  archiver_thin: List[str] = None     # Archiver for cxx.thinArchives, #None if not supported.
+  lto_archiver_thin: List[str] = None  # Archiver for cxx.thinArchives with LTO objects.
+  archiver_deterministic_modifier: str = None  # Added to the archiver operation with build:reproducible.
 
   executable_suffix = options.namingScheme['e']
   library_prefix = options.namingScheme['lp']
@@ -175,7 +425,186 @@ class Compiler:
     Called to allow the compiler additional translation steps.
     """
 
-  def get_compile_command(self, target, data, lang):
+  def get_lto_mode(self, data):
+    """
+    Returns the LTO mode to use for the target. If the toolchain does not
+    support the mode specified in `cxx.lto`, it falls back to full LTO.
+    """
+
+    if data.lto == 'none' or data.lto in self.lto_compile_flags:
+      return data.lto
+    mode = 'full' if 'full' in self.lto_compile_flags else 'none'
+    print('[WARNING]: {} does not support cxx.lto={!r}, using {!r}'.format(
+      self.name, data.lto, mode))
+    return mode
+
+  def get_lto_jobs(self, data):
+    """
+    Returns the number of parallel LTO backend jobs per link step. Unless
+    explicitly specified with the `cxx:ltoJobs` option, the available cores
+    are divided among the link steps that may run in parallel (see
+    `cxx:ltoLinkJobs`), which is what Ninja uses as its default parallelism.
+    """
+
+    if options.ltoJobs > 0:
+      return str(options.ltoJobs)
+    return str(max(1, (os.cpu_count() or 1) // max(1, options.ltoLinkJobs)))
+
+  def get_lto_cache_directory(self):
+    return path.join(session.build_directory, 'cxx.ltocache')
+
+  def get_lto_cache_flag(self, data):
+    return self.lto_cache_flag
+
+  def select_linker(self, data):
+    """
+    Returns the name of the linker to use for the target, or #None to use
+    the toolchain's default linker. The default implementation falls back
+    to the default linker if the linker specified in `cxx.linker` is not
+    supported by the toolchain or not available.
+    """
+
+    if not data.linker:
+      return None
+    if data.linker not in self.linkers or self.get_linker_select_flags(data.linker) is None:
+      print('[WARNING]: linker {!r} is not available for {}, using the default linker'
+        .format(data.linker, self.name))
+      return None
+    return data.linker
+
+  def get_linker_select_flags(self, name):
+    """
+    Returns the flags to select the linker *name*, or #None if the linker is
+    not available. Subclasses may probe the linker.
+    """
+
+    return self.expand(self.linker_select_flag, name)
+
+  def get_export_flags(self, data):
+    """
+    Returns the linker flags for `cxx.exportMap`, `cxx.symbolicFunctions`,
+    `cxx.bindNow` and `cxx.hashStyle`.
+    """
+
+    flags = []
+    if data.exportMap:
+      if not self.export_map_flag:
+        print('[WARNING]: cxx.exportMap is not supported by {}'.format(self.name))
+      flags += self.expand(self.export_map_flag, data.exportMap)
+    if data.symbolicFunctions and is_sharedlib(data):
+      flags += self.expand(self.symbolic_functions_flag)
+    if data.bindNow:
+      flags += self.expand(self.bind_now_flag)
+    if data.hashStyle:
+      flags += self.expand(self.hash_style_flag, data.hashStyle)
+    return flags
+
+  def get_icf_flags(self, data):
+    """
+    Returns the linker flags for `cxx.identicalCodeFolding`.
+    """
+
+    mode = data.identicalCodeFolding
+    if not mode or mode == 'none':
+      return []
+    if mode not in ('safe', 'all'):
+      error('invalid cxx.identicalCodeFolding: {!r}'.format(mode))
+    if not self.icf_flag or (self.icf_linkers is not None and data.linker not in self.icf_linkers):
+      print('[WARNING]: cxx.identicalCodeFolding is not supported by {} with linker {!r}'
+        .format(self.name, data.linker or 'default'))
+      return []
+    return self.expand(self.icf_flag, mode)
+
+  def get_linker_flags(self, data):
+    """
+    Returns the flags to select the linker that was chosen with
+    #select_linker() and to set the number of threads it may use.
+    """
+
+    if not data.linker:
+      return []
+    flags = list(self.get_linker_select_flags(data.linker))
+    if options.linkerThreads > 0:
+      flags += self.expand(self.linker_threads_flag.get(data.linker, []), str(options.linkerThreads))
+    return flags
+
+  def query_pkg_config(self, package, static):
+    """
+    Returns a tuple of the linker flags and the `libdir` that pkg-config
+    reports for *package*, or #None if the package is not available.
+    """
+
+    cache = self.__dict__.setdefault('_pkg_config', {})
+    if (package, static) not in cache:
+      command = ['pkg-config', package, '--libs'] + (['--static'] if static else [])
+      try:
+        flags = sh.split(sh.check_output(command, stderr=sh.DEVNULL).decode())
+        libdir = sh.check_output(['pkg-config', package, '--variable=libdir'],
+          stderr=sh.DEVNULL).decode().strip()
+      except (OSError, sh.CalledProcessError):
+        cache[(package, static)] = None
+      else:
+        cache[(package, static)] = (flags, libdir)
+    return cache[(package, static)]
+
+  def find_library(self, name, static):
+    """
+    Probes the system for the library *name* that could not be found with
+    pkg-config. Returns the path to the library or #None.
+    """
+
+    return None
+
+  def get_allocator_link(self, data):
+    """
+    Returns a tuple of the linker flags and the input files to link the memory
+    allocator selected with `cxx.allocator` into an executable. The library
+    is taken from a dependency that builds it (see `cxx.allocatorProvider`),
+    from pkg-config or from #find_library(), in that order.
+
+    The allocator is placed before all other libraries. A static allocator
+    library is linked as a whole, otherwise the C runtime could still provide
+    some of the allocation functions, and a shared one is kept by the linker
+    even though no symbol is referenced from it directly.
+    """
+
+    if data.type != 'executable' or data.allocator == 'system':
+      return [], []
+
+    package, name = ALLOCATORS[data.allocator]
+    static = data.runtimeLibrary == 'static'
+    library = data.outAllocatorLibraries.get(data.allocator)
+    libs, libpaths, extra = [], [], []
+    if not library:
+      info = self.query_pkg_config(package, static)
+      if info:
+        pkg_flags, libdir = info
+        for flag in pkg_flags:
+          if flag.startswith('-l'): libs.append(flag[2:])
+          elif flag.startswith('-L'): libpaths.append(flag[2:])
+          else: extra.append(flag)
+        archive = path.join(libdir, self.library_prefix + name + self.library_static_suffix)
+        if static and libdir and path.isfile(archive):
+          library = archive
+          libs = [x for x in libs if x != name]
+      else:
+        library = self.find_library(name, static)
+        if not library:
+          error('cxx.allocator: {} was not found with pkg-config ({}) or in the '
+            'library search path'.format(data.allocator, package))
+
+    flags = list(stream.concat([self.expand(self.linker_libpath, x) for x in stream.unique(libpaths)]))
+    flags += self.expand(self.keep_libraries_begin_flag)
+    if library and library.endswith(self.library_static_suffix):
+      flags += self.expand(self.whole_archive_flag, library)
+    elif library:
+      flags.append(library)
+    flags += stream.concat([self.expand(self.linker_lib, x) for x in stream.unique(libs)])
+    flags += self.expand(self.keep_libraries_end_flag)
+    flags += extra
+    return flags, [library] if library else []
+
+  def get_compile_command(self, target, data, lang, depfile=True):
     """
     This method is called to generate a command to build a C or C++ source
     file into an object file. The command must use action variables to
@@ -183,7 +612,8 @@ class Compiler:
     `${out,obj}`.
 
     The default implementation of this method constructs a command based on
-    the data members of the #Compiler subclass.
+    the data members of the #Compiler subclass. If *depfile* is #False, the
+    arguments to produce a depfile are omitted.
     """
 
     if data.type not in ('executable', 'library'):
@@ -198,6 +628,8 @@ class Compiler:
       defines += list(data.definesForSharedBuild)
     elif data.type == 'library' and data.preferredLinkage == 'static':
       defines += list(data.definesForStaticBuild)
+    if data.exportMacro and data.type == 'library':
+      defines.append('{}={}'.format(data.exportMacro, self.export_attribute if is_sharedlib(data) else ''))
     if data.addDebugDefines:
       defines = (['DEBUG', '_DEBUG'] if BUILD.debug else ['NDEBUG']) + defines
 
@@ -269,27 +701,545 @@ class Compiler:
       command += self.expand(self.debug_flag)
     if forced_includes:
       command += stream.concat(self.expand(self.force_include, x) for x in forced_includes)
-
-    if self.depfile_args:
+    if lang == 'cpp' and data._modules:
+      command += self.expand(self.modules_flag)
+    if data.lto != 'none':
+      command += self.expand(self.lto_compile_flags[data.lto])
+    if data.discardUnusedData:
+      command += self.expand(self.discard_unused_compile_flag)
+    if data.visibility not in (None, '', 'default', 'hidden', 'hiddenInlines', 'minimal'):
+      error('invalid cxx.visibility: {!r}'.format(data.visibility))
+    if data.visibility in ('hidden', 'minimal'):
+      command += self.expand(self.visibility_hidden_flag)
+    if data.visibility in ('hiddenInlines', 'minimal') and lang == 'cpp':
+      command += self.expand(self.visibility_inlines_hidden_flag)
+    command += self.get_pgo_flags(data)
+    if data.timeTrace:
+      command += self.expand(self.time_trace_flag)
+    command += self.get_prefix_map_flags()
+    if session.reproducible:
+      command += self.expand(self.reproducible_compile_flags)
+
+    if self.depfile_args and depfile:
       command += self.expand(self.depfile_args)
 
     return command
 
-  def create_compile_action(self, target, data, action_name, lang, srcs):
-    command = self.get_compile_command(target, data, lang)
-    op = operator(action_name, commands=[command], environ=self.compiler_env,
-                  deps_prefix=self.deps_prefix)
+  def get_prefix_map_flags(self):
+    """
+    Returns the flags that map the root directories of relocatable action
+    keys (see #get_path_roots()) to fixed paths in the object files. The
+    source root maps to `.`, other roots to their path relative to the
+    source root, or to `/<name>` if they are outside of it. The flags are
+    also used for reproducible builds.
+    """
+
+    roots = get_path_roots(session.options, session.build_root, always=session.reproducible)
+    if not roots or not self.file_prefix_map_flag:
+      return []
+    source = roots['SOURCE']
+    flags = []
+    # The compiler uses the last matching mapping, thus the more specific
+    # (longer) roots come last.
+    for name, root in sorted(roots.items(), key=lambda x: len(x[1])):
+      if name == 'SOURCE':
+        mapped = '.'
+      elif path.issub(path.rel(root, source)):
+        mapped = path.rel(root, source)
+      else:
+        mapped = '/' + name.lower()
+      flags += self.expand(self.file_prefix_map_flag, '{}={}'.format(root, mapped))
+    return flags
+
+  def create_compile_actions(self, target, data, action_name, lang, srcs,
+                             interface=False, required_headers=()):
+    """
+    Groups the *srcs* by the `cxx.sourceOverrides` that apply to them and
+    calls #create_compile_action() for every group, so that sources with the
+    same effective flags share an operator. Returns the list of object files.
+    """
+
+    groups = collections.OrderedDict()
+    for src in srcs:
+      groups.setdefault(match_source_overrides(data, src), []).append(src)
+    obj_files = []
+    for patterns, group in groups.items():
+      group_data = apply_source_overrides(data, patterns) if patterns else data
+      obj_files += self.create_compile_action(target, group_data, action_name,
+        lang, group, interface, required_headers)
+    return obj_files
+
+  def create_compile_action(self, target, data, action_name, lang, srcs,
+                            interface=False, required_headers=()):
+    """
+    Creates the operator that compiles the C or C++ *srcs* into object
+    files. If *interface* is #True, the sources are C++20 module interface
+    units and a BMI is produced in addition to the object file. Returns the
+    list of object files.
+
+    Sources are compiled into a shared object directory that is named after
+    the hash of the command (see #get_shared_object_directory()), thus
+    another target that compiles them with the same command reuses the
+    object file (see #get_shared_object_key()). The operator is only created
+    if any source is left to be compiled.
+    """
 
-    objdir = path.join(target.build_directory, 'obj')
+    command = self.get_compile_command(target, data, lang)
+    modules = data._modules if lang == 'cpp' else None
+    if modules:
+      command += self.expand(self.modules_mapper_flag, '${<modmap}')
+      if interface:
+        index = command.index('${<src}')
+        command[index:index] = self.expand(self.modules_interface_flag)
+        command += self.expand(self.modules_output_flag, '${@bmi}')
+    # Module map files are specific to the target, and the GCC profile data is
+    # matched by the path of the object in the target's object directory.
+    share_command = None if modules or data._pgoStage or not options.shareObjects else command
+    command = self.make_response_file(target, lang, command)
+    if options.distribute and self.supports_distributed_compile and not modules:
+      command = self.get_distribute_prefix() + command
+    implicit_inputs = list(required_headers) + ([data._pgoDepends] if data._pgoDepends else [])
+
+    op = None
+    obj_files = []
+    objdir = data._objdir
+    if share_command:
+      objdir = self.get_shared_object_directory(lang, share_command, implicit_inputs)
     for src in srcs:
+      key = share_command and self.get_shared_object_key(lang, share_command, src, implicit_inputs)
+      if key in _shared_objects:
+        obj_files.append(_shared_objects[key])
+        continue
+      if op is None:
+        # The action cache can not restore the headers that MSVC reports on
+        # stdout, nor the BMIs of imported modules. An object that does not
+        # change (eg. after a comment was edited) does not relink.
+        op = operator(action_name, commands=[command], environ=self.compiler_env,
+                      deps_prefix=self.deps_prefix,
+                      cacheable=not modules and not self.deps_prefix,
+                      early_cutoff=True, tool=self.expand(getattr(self, 'compiler_' + lang))[0])
       bset = BuildSet({'src': src}, {})
-      self.add_objects_for_source(target, data, lang, src, bset, objdir)
+      self.add_objects_for_source(None if key else target, data, lang, src, bset, objdir)
       obj_file = bset.outputs['obj'][0]
       if self.depfile_name:
         bset.depfile = TemplateCompiler().compile(self.depfile_name).render({}, {'obj': [obj_file]}, {})[0]
+      if modules:
+        modules.add_to_build_set(bset, interface)
+      if required_headers:
+        bset.add_input_files('?required-headers', required_headers)
+      if data._pgoDepends:
+        bset.add_input_files('?pgo-profile', [data._pgoDepends])
       op.add_build_set(bset)
+      if key:
+        _shared_objects[key] = obj_file
+      obj_files.append(obj_file)
 
-    return op
+    return obj_files
+
+  def get_distribute_prefix(self):
+    """
+    Returns the command prefix that runs a compile command through the
+    `dist-compile` tool, which preprocesses the source locally and compiles
+    it on one of the workers in the cxx:distribute option.
+    """
+
+    tool = str(require.resolve('net.craftr.tool.dist-compile').filename)
+    return [sys.executable, tool, 'compile', '--workers', options.distribute, '--']
+
+  def get_shared_object_directory(self, lang, command, implicit_inputs):
+    """
+    Returns the directory for the object files that are compiled with
+    *command* and shared between targets. It is named after the hash of the
+    command, thus it does not depend on the targets that use the objects.
+    """
+
+    key = [lang, command, self.compiler_env, sorted(implicit_inputs)]
+    digest = hashlib.sha1(json.dumps(key, sort_keys=True).encode('utf8')).hexdigest()
+    return path.join(session.build_directory, 'cxx-shared', digest[:16])
+
+  def get_shared_object_key(self, lang, command, src, implicit_inputs):
+    """
+    Returns the key under which the object file that *command* compiles from
+    *src* is shared between targets. The command references the object file
+    only through variables, thus it does not depend on the object directory
+    of the target.
+    """
+
+    key = [lang, command, self.compiler_env, path.abs(src), sorted(implicit_inputs)]
+    return hashlib.sha1(json.dumps(key, sort_keys=True).encode('utf8')).hexdigest()
+
+  def make_response_file(self, target, lang, command):
+    """
+    Moves the arguments of the compile *command* that are the same for all
+    build sets (ie. that do not reference any variables) into a response file
+    and returns the new command. The response file is named after the hash
+    of its contents, thus the command changes (and the objects are rebuilt)
+    exactly when the flags change. With `build:relocatableKeys`, the hash is
+    computed with the root directories replaced (see #get_path_roots()), so
+    that the command is the same in another checkout.
+    """
+
+    if not self.compiler_response_file or not options.responseFiles:
+      return command
+
+    driver = len(self.expand(getattr(self, 'compiler_' + lang)))
+    args = command[driver:]
+    keep, flags = command[:driver], []
+    for index, arg in enumerate(args):
+      # Options that take a variable as separate value must stay in
+      # front of it (eg. `-o ${@obj}`).
+      value = args[index+1] if index + 1 < len(args) else ''
+      bound = arg.startswith(('-', '/')) and '$' in value and not value.startswith(('-', '/'))
+      if '$' in arg or bound:
+        keep.append(arg)
+      else:
+        flags.append(arg)
+    if len(flags) < 2:
+      return command
+
+    content = ''.join(self.quote_response_file_arg(x) + '\n' for x in flags)
+    relocated = build.relocate_paths(content, get_path_roots(session.options, session.build_root))
+    digest = hashlib.sha1(relocated.encode('utf8')).hexdigest()[:16]
+    filename = path.join(target.build_directory, 'cxx.rsp', digest + '.rsp')
+    path.makedirs(path.dir(filename))
+    with nr.fs.mtime_consistent_file(filename, 'w') as fp:
+      fp.write(content)
+    return keep[:driver] + self.expand(self.compiler_response_file, filename) + keep[driver:]
+
+  def quote_response_file_arg(self, arg):
+    return '"' + arg.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+  def get_module_flags_key(self, target, data):
+    """
+    Returns a hash of the compile settings that must match for a BMI to be
+    usable by another target. Include paths and defines are not taken into
+    account as they do not leak through module boundaries, nor is position
+    independent code, so that executables can import the modules of the
+    libraries that they link with.
+    """
+
+    key = [data.cppStd, data.cppStdlib, data.enableExceptions, data.enableRtti,
+           BUILD.debug, data.optimization, sorted(data.compilerFlags)]
+    return hashlib.sha1(json.dumps(key).encode('utf8')).hexdigest()[:12]
+
+  def get_module_scan_command(self, target, data):
+    """
+    Returns a tuple of the command that scans a C++ source file `${<src}`
+    for its module dependencies and writes a P1689 file to `${@ddi}`, and
+    the template for the depfile name (or #None). The object file that the
+    source will be compiled to is available as the variable `${obj}`.
+    """
+
+    raise NotImplementedError
+
+  def get_header_unit_commands(self, target, data):
+    """
+    Returns a list of commands that compile the system header `${header}`
+    into a header unit, producing `${@bmi}`.
+    """
+
+    raise NotImplementedError
+
+  def create_module_actions(self, target, data, cpp_srcs, interface_srcs):
+    """
+    Creates the operators that scan the C++ sources of the target for module
+    dependencies, compile the requested header units and collate the scan
+    results into a dyndep file and a module map per translation unit. The
+    returned #ModuleInfo is stored in `data._modules` and consumed by
+    #create_compile_action().
+
+    BMIs of dependencies are shared if they were compiled with matching
+    flags (see #get_module_flags_key()).
+    """
+
+    if not self.modules_supported:
+      error('{} does not support C++20 modules'.format(self.name))
+
+    moddir = path.join(target.build_directory, 'cxx.modules')
+    objdir = data._objdir
+    info = data._modules = ModuleInfo(moddir, self.modules_bmi_suffix)
+    key = self.get_module_flags_key(target, data)
+
+    deps_json = []
+    for dep in target.transitive_dependencies():
+      provider = _module_providers.get(dep.target.id)
+      if not provider:
+        continue
+      if provider['key'] != key:
+        error('BMIs of "{}" can not be shared with "{}", the compile flags '
+              'differ. Align cxx.cppStd, cxx.compilerFlags, etc. of both targets.'
+              .format(dep.target.id, target.id))
+      deps_json.append(provider['modules'])
+
+    path.makedirs(moddir)
+    if data.headerUnits:
+      if self.modules_mapper_format == 'gcc':
+        # GCC places header units relative to the repository root.
+        info.header_unit_mapper = path.join(moddir, 'header-units.map')
+        with nr.fs.mtime_consistent_file(info.header_unit_mapper, 'w') as fp:
+          fp.write('$root {}\n'.format(info.header_unit_dir))
+        suffix = '.stamp'
+      else:
+        suffix = self.modules_bmi_suffix
+      operator('cxx.compileHeaderUnits', commands=self.get_header_unit_commands(target, data),
+               environ=self.compiler_env)
+      for name in data.headerUnits:
+        bmi = path.join(info.header_unit_dir, re.sub(r'[^\w\.]+', '_', name) + suffix)
+        info.header_units[name] = bmi
+        build_set({}, {'bmi': bmi}, {'header': name}, description='Header unit <{}>'.format(name))
+
+    scan_command, scan_depfile = self.get_module_scan_command(target, data)
+    op = operator('cxx.scanModules', commands=[scan_command], environ=self.compiler_env)
+    sources = []
+    for src in interface_srcs + cpp_srcs:
+      obj = self.get_object_filename(target, src, objdir)
+      bset = BuildSet({'src': src}, {'ddi': obj + '.ddi'}, {'obj': obj})
+      if info.header_units:
+        bset.add_input_files('?header-units', list(info.header_units.values()))
+      if scan_depfile:
+        bset.depfile = TemplateCompiler().compile(scan_depfile).render({}, bset.outputs, {})[0]
+      op.add_build_set(bset)
+      sources.append({
+        'src': src,
+        'ddi': bset.outputs['ddi'][0],
+        'obj': obj,
+        'bmi': info.get_bmi(obj) if src in interface_srcs else None,
+        'modmap': info.get_modmap(obj)
+      })
+
+    plan = {
+      'format': self.modules_mapper_format,
+      'sources': sources,
+      'deps': deps_json,
+      'header_units': info.header_units,
+      'header_unit_dir': info.header_unit_dir if info.header_unit_mapper else None,
+      'dyndep': info.dyndep,
+      'modules': info.modules_json
+    }
+    plan_file = path.join(moddir, 'plan.json')
+    with nr.fs.mtime_consistent_file(plan_file, 'w') as fp:
+      json.dump(plan, fp, indent=2, sort_keys=True)
+
+    command = [sys.executable, COLLATE_MODULES_TOOL, '$<plan']
+    operator('cxx.collateModules', commands=[command], restat=True)
+    build_set(
+      {'plan': plan_file, 'ddi': [x['ddi'] for x in sources], 'deps': deps_json},
+      {'dyndep': info.dyndep, 'modules': info.modules_json,
+       'modmap': [x['modmap'] for x in sources]},
+      description='Collating C++ modules of {}'.format(target.id))
+
+    if interface_srcs:
+      _module_providers[target.id] = {'key': key, 'modules': info.modules_json}
+
+    return info
+
+  def get_isa_variant_data(self, data, variant):
+    """
+    Returns a copy of the cxx *data* to compile the `cxx.isaSources` for the
+    ISA *variant* (or #None for the default variant). The functions listed in
+    `cxx.isaFunctions` are renamed with a variant-specific suffix using
+    preprocessor definitions.
+    """
+
+    if not self.isa_flag:
+      error('{} does not support cxx.isaVariants'.format(self.name))
+    suffix = get_isa_suffix(variant)
+    result = ObjectFromDict(dict(ObjectAsDict(data)))
+    result.isaVariants = []
+    result._objdir = path.join(data._objdir, 'isa', suffix)
+    result.defines = list(data.defines) + ['{0}={0}_{1}'.format(parse_function_decl(x)[1], suffix)
+                                           for x in data.isaFunctions]
+    if variant:
+      result.compilerFlags = list(data.compilerFlags) + self.expand(self.isa_flag, variant)
+    return result
+
+  def write_isa_dispatch(self, target, data, lang):
+    """
+    Generates the translation unit that defines the functions listed in
+    `cxx.isaFunctions` and dispatches them to the best ISA variant for the
+    CPU. On ELF platforms, the variant is selected when the library is loaded
+    using an ifunc, otherwise on the first call. Returns the filename.
+    """
+
+    filename = path.join(target.build_directory, 'cxx.isa', 'dispatch.' + lang)
+    functions = [parse_function_decl(x) for x in data.isaFunctions]
+    variants = list(reversed(data.isaVariants))  # Best variant first.
+    lines = ['/* Generated by Craftr for {}. Do not edit. */'.format(target.id),
+             '#include <stddef.h>', '#include <stdint.h>']
+    if data.isaHeader:
+      lines.append('#include "{}"'.format(path.abs(data.isaHeader).replace('\\', '/')))
+    lines += ['',
+      '#if defined(__ELF__) && (defined(__x86_64__) || defined(__i386__))',
+      '#define CRAFTR_ISA_IFUNC 1', '#endif', '',
+      'static int craftr_isa_select(void) {',
+      '#if defined(__x86_64__) || defined(__i386__)',
+      '  __builtin_cpu_init();']
+    for index, variant in enumerate(variants):
+      features = ISA_LEVEL_FEATURES.get(variant)
+      if features:
+        cond = ' && '.join('__builtin_cpu_supports("{}")'.format(x) for x in features)
+      else:
+        cond = '__builtin_cpu_is("{}")'.format(variant)
+      lines.append('  if ({}) return {};'.format(cond, index + 1))
+    lines += ['#endif', '  return 0;', '}', '']
+    # The resolver is referenced by its assembler name, thus it must not
+    # be subject to C++ name mangling.
+    extern_c = lang == 'cpp'
+    for ret, name, params, names in functions:
+      typedef = name + '_craftr_isa_fn'
+      lines.append('typedef {} (*{})({});'.format(ret, typedef, params))
+      for variant in [None] + variants:
+        lines.append('{} {}_{}({});'.format(ret, name, get_isa_suffix(variant), params))
+      if extern_c:
+        lines.append('extern "C" {')
+      lines.append('static {} {}_craftr_isa_resolve(void) {{'.format(typedef, name))
+      lines.append('  switch (craftr_isa_select()) {')
+      for index, variant in enumerate(variants):
+        lines.append('    case {}: return {}_{};'.format(index + 1, name, get_isa_suffix(variant)))
+      lines += ['    default: return {}_default;'.format(name), '  }', '}']
+      if extern_c:
+        lines.append('}')
+      lines.append('#ifdef CRAFTR_ISA_IFUNC')
+      lines.append('{} {}({}) __attribute__((ifunc("{}_craftr_isa_resolve")));'.format(ret, name, params, name))
+      lines.append('#else')
+      lines.append('static {} {}_craftr_isa_impl;'.format(typedef, name))
+      lines.append('{} {}({}) {{'.format(ret, name, params))
+      lines.append('  if (!{0}_craftr_isa_impl) {0}_craftr_isa_impl = {0}_craftr_isa_resolve();'.format(name))
+      call = '{}_craftr_isa_impl({})'.format(name, ', '.join(names))
+      lines.append('  ' + (call if ret == 'void' else 'return ' + call) + ';')
+      lines += ['}', '#endif', '']
+
+    path.makedirs(path.dir(filename))
+    with nr.fs.mtime_consistent_file(filename, 'w') as fp:
+      fp.write('\n'.join(lines) + '\n')
+    return filename
+
+  def get_pgo_flags(self, data, link=False):
+    """
+    Returns the compiler (or linker, if *link* is #True) flags for the
+    profile-guided optimization stage of the target.
+    """
+
+    if not data._pgoStage:
+      return []
+    if not self.pgo_generate_flag:
+      error('{} does not support cxx.pgo'.format(self.name))
+    if data._pgoStage == 'generate':
+      flags = self.expand(self.pgo_generate_flag, data._pgoRawDir)
+    elif link:
+      return []
+    else:
+      flags = self.expand(self.pgo_use_flag, data._pgoProfile)
+    if data.pgo == 'train':
+      # The instrumented and the optimized objects live in different
+      # directories, but their profile data must be matched.
+      flags += self.expand(self.pgo_prefix_flag, data._objdir)
+    return flags
+
+  def get_training_command(self, data, prefix, exe):
+    """
+    Returns the training workload command from the `TrainCommand` and
+    `TrainArgs` properties with the specified *prefix* (falling back to the
+    `cxx.pgo` properties) that runs the executable *exe*.
+    """
+
+    command = getattr(data, prefix + 'TrainCommand') or data.pgoTrainCommand
+    if command:
+      return [x.replace('$(exe)', exe) for x in command]
+    return [exe] + list(getattr(data, prefix + 'TrainArgs') or data.pgoTrainArgs)
+
+  def create_pgo_actions(self, target, data, instr):
+    """
+    Creates the operators for `cxx.pgo=train` that run the training
+    workload with *instr*, the instrumented build of the target, and that
+    produce the profile from the raw profile data. The `cxx.pgoMerge`
+    operator only updates the profile if its content changes, thus the
+    optimized build in *data* is only repeated in that case.
+    """
+
+    pgodir = path.join(target.build_directory, 'pgo')
+    rawdir = instr._pgoRawDir
+    exe = path.abs(instr.productFilename)
+    train = self.get_training_command(data, 'pgo', exe)
+    clean = [sys.executable, '-c', 'import shutil, sys; shutil.rmtree(sys.argv[1], True)', rawdir]
+    touch = [sys.executable, '-c', 'import sys; open(sys.argv[1], "w").close()', '${@stamp}']
+    environ = {k: v.replace('%ARG%', rawdir) for k, v in self.pgo_train_env.items()}
+    operator('cxx.pgoTrain', commands=[clean, train, touch], environ=environ,
+             explicit=True, cwd=data.runCwd)
+    build_set({'exe': [exe], 'in': data.pgoTrainInputs},
+              {'stamp': [path.join(pgodir, 'train.stamp')]},
+              description='Training {}'.format(target.id))
+
+    profile = path.join(pgodir, 'merged.profdata' if self.pgo_merge else 'profile.sha1')
+    command = [sys.executable, PGO_PROFILE_TOOL, '${@profile}', rawdir]
+    if self.pgo_merge:
+      command += ['--'] + self.expand(self.pgo_merge)
+    operator('cxx.pgoMerge', commands=[command], environ=self.compiler_env, restat=True)
+    build_set({'stamp': [path.join(pgodir, 'train.stamp')]}, {'profile': [profile]},
+              description='Merging profile data of {}'.format(target.id))
+
+    # GCC reads the .gcda files directly, the digest only tracks changes.
+    data._pgoProfile = profile if self.pgo_merge else rawdir
+    data._pgoDepends = profile
+
+  def create_bolt_actions(self, target, data):
+    """
+    Creates the explicit operators for `cxx.bolt` that profile the linked
+    executable with the training workload and produce a binary that is
+    optimized with BOLT. The profile is either sampled with `perf` or
+    collected with a binary that was instrumented by BOLT. It is only
+    updated if its content changes.
+    """
+
+    if not self.llvm_bolt:
+      error('{} does not support cxx.bolt'.format(self.name))
+    if data.type != 'executable':
+      error('cxx.bolt is only supported for executables')
+
+    mode = data.bolt
+    if mode == 'auto':
+      mode = 'perf' if shutil.which(self.perf[0]) else 'instrument'
+    if mode not in ('perf', 'instrument'):
+      error('invalid cxx.bolt: {!r}'.format(data.bolt))
+
+    boltdir = path.join(target.build_directory, 'bolt')
+    exe = path.abs(data.productFilename)
+    fdata = path.join(boltdir, 'profile.fdata')
+    train_inputs = list(data.boltTrainInputs or data.pgoTrainInputs)
+    replace = [sys.executable, REPLACE_IF_CHANGED_TOOL]
+
+    if mode == 'perf':
+      record = self.perf + ['record', '-e', 'cycles:u', '-j', 'any,u', '-o', '${@perfdata}', '--']
+      record += self.get_training_command(data, 'bolt', exe)
+      operator('cxx.boltRecord', commands=[record], explicit=True, cwd=data.runCwd)
+      build_set({'exe': [exe], 'in': train_inputs},
+                {'perfdata': [path.join(boltdir, 'perf.data')]},
+                description='Recording profile of {}'.format(target.id))
+      convert = self.perf2bolt + ['-p', '${<perfdata}', '-o', '${@fdata}.tmp', '${<exe}']
+      operator('cxx.boltProfile', commands=[convert, replace + ['${@fdata}.tmp', '${@fdata}']],
+               explicit=True, restat=True)
+      build_set({'exe': [exe], 'perfdata': [path.join(boltdir, 'perf.data')]},
+                {'fdata': [fdata]}, description='Converting profile of {}'.format(target.id))
+    else:
+      instr = path.join(boltdir, path.base(exe) + '.instr')
+      raw = path.join(boltdir, 'instr.fdata')
+      instrument = self.llvm_bolt + ['${<exe}', '-instrument', '-instrumentation-file=' + raw, '-o', '${@instr}']
+      operator('cxx.boltInstrument', commands=[instrument], explicit=True)
+      build_set({'exe': [exe]}, {'instr': [instr]},
+                description='Instrumenting {}'.format(target.id))
+      clean = [sys.executable, '-c', 'import os, sys; os.path.isfile(sys.argv[1]) and os.remove(sys.argv[1])', raw]
+      train = self.get_training_command(data, 'bolt', instr)
+      operator('cxx.boltTrain', commands=[clean, train, replace + [raw, '${@fdata}']],
+               explicit=True, restat=True, cwd=data.runCwd)
+      build_set({'instr': [instr], 'in': train_inputs}, {'fdata': [fdata]},
+                description='Training {}'.format(target.id))
+
+    optimize = self.llvm_bolt + ['${<exe}', '-o', '${@product}', '-data=${<fdata}']
+    optimize += self.expand(self.bolt_optimize_flags)
+    operator('cxx.bolt', commands=[optimize], explicit=True)
+    build_set({'exe': [exe], 'fdata': [fdata]},
+              {'product': [path.join(boltdir, path.base(exe))]},
+              description='Optimizing {} with BOLT'.format(target.id))
 
   def add_objects_for_source(self, target, data, lang, src, buildset, objdir):
     """
@@ -299,17 +1249,33 @@ class Compiler:
     MSVC compiler will add the PDB file.
 
     The object file must be tagged as `out` and `obj`. Additional output files
-    should be tagged with at least `out` and maybe `optional`.
+    should be tagged with at least `out` and maybe `optional`. The *target*
+    is #None for objects that are shared between targets.
     """
 
-    obj = path.rel(src, target.directory)
+    obj = self.get_object_filename(target, src, objdir)
+    buildset.add_output_files('obj', [obj])
+    if data.timeTrace and self.time_trace_suffix:
+      buildset.add_output_files('timeTrace', [path.setsuffix(obj, self.time_trace_suffix)])
+
+  def get_object_filename(self, target, src, objdir):
+    """
+    Returns the object filename for the C or C++ source file *src*. If
+    *target* is #None, the object is shared between targets and its name is
+    relative to the source root instead of the target's directory.
+    """
+
+    if target is None:
+      root = get_path_roots(session.options, session.build_root, always=True)['SOURCE']
+    else:
+      root = target.directory
+    obj = path.rel(src, root)
     if not path.issub(obj):
       obj = path.rel(src, session.build_directory)
       if not path.issub(obj):
         # Just keep it in the directory that it is in.
         obj = path.abs(src)
-    obj = path.setsuffix(path.abs(obj, objdir), self.object_suffix)
-    buildset.add_output_files('obj', [obj])
+    return path.setsuffix(path.abs(obj, objdir), self.object_suffix)
 
   def get_link_command(self, target, data, lang):
     """
@@ -337,7 +1303,7 @@ class Compiler:
       data.runtimeLibrary = 'static' if options.staticRuntime else 'dynamic'
 
     if is_archive:
-      command = self.expand(self.archiver)
+      command = self.get_archiver(data)
       command.extend(self.expand(self.archiver_out, '${@product}'))
     else:
       command = self.expand(self.linker_cpp if lang == 'cpp' else self.linker_c)
@@ -349,9 +1315,30 @@ class Compiler:
     if data.enableOpenmp and self.compiler_supports_openmp and not is_staticlib(data):
       flags += self.linker_enable_openmp
 
+    if not is_archive:
+      flags += self.get_pgo_flags(data, link=True)
+    if session.reproducible:
+      flags += self.expand(self.reproducible_link_flags)
+
+    if data.lto != 'none' and not is_archive:
+      flags += self.expand(self.lto_link_flags[data.lto])
+      flags += self.expand(self.lto_jobs_flag, self.get_lto_jobs(data))
+      if data.lto == 'thin':
+        flags += self.expand(self.get_lto_cache_flag(data), self.get_lto_cache_directory())
+    if not is_archive:
+      flags += self.get_linker_flags(data)
+      if data.discardUnusedData:
+        flags += self.expand(self.discard_unused_link_flag)
+      flags += self.get_icf_flags(data)
+      flags += self.get_export_flags(data)
+      if data.bolt != 'none':
+        flags += self.expand(self.bolt_link_flag)
+
     libs = data.systemLibraries
 
     if not is_staticlib(data):
+      flags += self.get_allocator_link(data)[0]
+      flags += stream.unique(data.outSharedLibraries)
       runtime = self.linker_runtime.get(lang, {})
       if data.runtimeLibrary == 'static':
         flags += self.expand(runtime.get('static', []))
@@ -370,13 +1357,53 @@ class Compiler:
 
     return command
 
+  def get_archiver(self, data):
+    """
+    Returns the command to invoke the archiver for a static library. LTO
+    objects contain IR that the default archiver may not be able to index,
+    thus we need to use the compiler's archiver wrapper for them. With
+    `cxx.thinArchives`, an archiver that only references the object files
+    is used if the toolchain supports it.
+    """
+
+    lto = data.lto != 'none' and self.lto_archiver
+    archiver = None
+    if data.thinArchives:
+      archiver = self.lto_archiver_thin if lto else self.archiver_thin
+    command = self.expand(archiver or (self.lto_archiver if lto else self.archiver))
+    # Archives without timestamps, user and group IDs. The modifier belongs
+    # to the operation argument (eg. `rcs`), which may follow options like
+    # `--thin`.
+    modifier = self.archiver_deterministic_modifier
+    index = next((i for i, x in enumerate(command) if i > 0 and not x.startswith('-')), None)
+    if session.reproducible and modifier and index is not None and modifier not in command[index]:
+      command[index] += modifier
+    return command
+
   def get_link_commands(self, target, data, lang):
     command = self.get_link_command(target, data, lang)
     linker_cmd_len = len(self.linker_cpp if lang == 'cpp' else self.linker_c)
     command = build.Command(command, supports_response_file=True,
                             response_args_begin=linker_cmd_len)
+    if is_staticlib(data) and self.archiver_thin:
+      # The archiver updates an existing archive, which would keep members
+      # of removed objects and can not switch between thin and full archives.
+      remove = [sys.executable, '-c', 'import os, sys; os.path.isfile(sys.argv[1]) and os.remove(sys.argv[1])', '${@product}']
+      return [remove, command]
     return [command]
 
+  def get_link_tool(self, data, lang):
+    """
+    Returns the program that produces the product of *data*: the archiver
+    for static libraries and the linker otherwise. The link action records
+    its identity, not that of the commands that post-process the product
+    (eg. `objcopy` or `install_name_tool`).
+    """
+
+    if is_staticlib(data):
+      return self.get_archiver(data)[0]
+    return self.expand(self.linker_cpp if lang == 'cpp' else self.linker_c)[0]
+
   def create_link_action(self, target, data, action_name, lang, object_files):
     commands = self.get_link_commands(target, data, lang)
     input_files = list(object_files)
@@ -384,17 +1411,65 @@ class Compiler:
       input_files += data.outLinkLibraries + data.staticLibraries + data.dynamicLibraries
     if data.takeInputObjects:
       input_files += data.outObjectFiles
-    op = operator(action_name, commands=commands, environ=self.linker_env)
+    # LTO link steps run the optimizer in parallel themselves, thus we limit
+    # the number of them running concurrently.
+    pool = None
+    if data.lto != 'none' and not is_staticlib(data):
+      pool = 'cxx_lto_link'
+      session.add_pool(pool, max(1, options.ltoLinkJobs))
+    op = operator(action_name, commands=commands, environ=self.linker_env, pool=pool,
+                  tool=self.get_link_tool(data, lang))
     bset = BuildSet(
       {'in': input_files},
       {'product': data.productFilename})
+    if data.exportMap:
+      bset.add_input_files('?export-map', [data.exportMap])
+    if not is_staticlib(data):
+      bset.add_input_files('?allocator', self.get_allocator_link(data)[1])
+      bset.add_input_files('?interface-stubs', data.outInterfaceStubs)
     self.add_link_outputs(target, data, lang, bset)
     op.add_build_set(bset)
+    if is_sharedlib(data) and self.link_shared_libraries and not data.allocatorProvider:
+      self.create_interface_stub_action(target, data)
     return op
 
+  def create_interface_stub_action(self, target, data):
+    """
+    Creates the operator that writes the interface stub of a shared library,
+    a description of the symbols that it exports. The stub is only updated
+    if the exported symbols change (restat). Dependent targets link with
+    the library, but depend on its stub, thus changes to the implementation
+    of the library do not cause them to be relinked. If the toolchain has no
+    #interface_stub command, the dependents depend on the library itself.
+    """
+
+    stub = data.productFilename
+    if self.interface_stub:
+      stub = path.join(target.build_directory, data.productName + '.ifs')
+      command = [sys.executable, INTERFACE_STUB_TOOL, '--format', self.interface_stub_format, '-o', '${@stub}', '--']
+      command += self.expand(self.interface_stub, '$<in')
+      operator('cxx.interfaceStub', commands=[command], restat=True)
+      build_set({'in': [data.productFilename]}, {'stub': [stub]},
+                description='Interface stub of {}'.format(target.id))
+    properties({
+      '@+cxx.outSharedLibraries': [data.productFilename],
+      '@+cxx.outInterfaceStubs': [stub]
+    }, target=target)
+
   def add_link_outputs(self, target, data, lang, buildset):
-    if is_staticlib(data):
+    # An allocator library is only linked into the executables that select
+    # it with cxx.allocator.
+    if data.allocatorProvider and data.type == 'library':
+      properties({'@+cxx.outAllocatorLibraries': {data.allocatorProvider: data.productFilename}}, target=target)
+    elif is_staticlib(data):
       properties({'@+cxx.outLinkLibraries': [data.productFilename]}, target=target)
+    # Pass the export macro and the shared build definitions on to the
+    # dependent targets.
+    if data.exportMacro and data.type == 'library':
+      value = self.import_attribute if is_sharedlib(data) else ''
+      properties({'@+cxx.defines': ['{}={}'.format(data.exportMacro, value)]}, target=target)
+    if is_sharedlib(data) and data.definesForSharedBuild:
+      properties({'@+cxx.defines': list(data.definesForSharedBuild)}, target=target)
 
   def nolink(self, target, data, obj):
     """
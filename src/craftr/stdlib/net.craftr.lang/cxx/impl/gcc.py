@@ -1,4 +1,7 @@
 
+import os
+import shutil
+import subprocess
 import sys
 import base from './base'
 import {get_gcc_info} from 'net.craftr.compiler.mingw'
@@ -17,10 +20,16 @@ class GccCompiler(base.Compiler):
 
   def __init__(self, cross_prefix='', **kwargs):
     if cross_prefix:
-      for key in ('compiler_c', 'compiler_cpp', 'linker_c', 'linker_cpp'):
+      for key in ('compiler_c', 'compiler_cpp', 'linker_c', 'linker_cpp', 'lto_archiver', 'lto_archiver_thin', 'objcopy', 'dwp', 'interface_stub'):
+        if getattr(self, key) is None:
+          continue  # Not supported by the toolchain (eg. MinGW or Darwin).
         args = getattr(self, key)[:]
         args[0] = cross_prefix + args[0]
         setattr(self, key, args)
+    if session.options.get('build:remoteCache'):
+      # The system headers must be part of the action keys of the remote
+      # cache, which is shared by machines with different system headers.
+      self.depfile_args = ['-MD', '-MF', '${@obj}.d']
     if 'arch' not in kwargs or 'version' not in kwargs:
       info = get_gcc_info(self.compiler_c, self.compiler_env or kwargs.get('compiler_env'))
       kwargs.setdefault('arch', 'x64' if '64' in info['target'] else 'x86')
@@ -57,6 +66,43 @@ class GccCompiler(base.Compiler):
   save_temps = '-save-temps'
   depfile_args = ['-MMD', '-MF', '${@obj}.d']
   depfile_name = '${@obj}.d'
+  compiler_response_file = '@%ARG%'
+
+  # Tools for cxx.separateDebugInformation. On macOS, the debug information
+  # is extracted into a dSYM bundle instead of splitting it from the objects.
+  split_dwarf_flag = '-gsplit-dwarf'
+  objcopy = ['objcopy']
+  dwp = ['dwp']
+  dsymutil = ['dsymutil']
+
+  modules_supported = True
+  modules_flag = ['-fmodules-ts']
+  modules_interface_flag = ['-x', 'c++']
+  modules_output_flag = []  # BMI location is specified in the module mapper.
+  modules_mapper_flag = ['-fmodule-mapper=%ARG%']
+  modules_mapper_format = 'gcc'
+  modules_bmi_suffix = '.gcm'
+
+  # GCC has no ThinLTO, but partitions the program for parallel
+  # optimization by default (WHOPR).
+  lto_compile_flags = {'full': ['-flto']}
+  lto_link_flags = {'full': []}
+  lto_jobs_flag = '-flto=%ARG%'
+  lto_archiver = ['gcc-ar', 'rcs']
+  lto_archiver_thin = ['gcc-ar', 'rcsTD']
+
+  isa_flag = '-march=%ARG%'
+
+  # GCC can only print the time report to the build log.
+  time_trace_flag = '-ftime-report'
+
+  file_prefix_map_flag = '-ffile-prefix-map=%ARG%'
+
+  supports_distributed_compile = True
+
+  pgo_generate_flag = '-fprofile-generate=%ARG%'
+  pgo_use_flag = ['-fprofile-use=%ARG%', '-fprofile-correction', '-Wno-missing-profile']
+  pgo_prefix_flag = '-fprofile-prefix-path=%ARG%'
 
   compiler_supports_openmp = True
   compiler_enable_openmp = ['-fopenmp']
@@ -75,11 +121,63 @@ class GccCompiler(base.Compiler):
     'cpp': {'static': '-static-libstdc++', 'dynamic': []}
   }
 
+  linkers = ['bfd', 'gold', 'lld', 'mold']
+  linker_select_flag = '-fuse-ld=%ARG%'
+  linker_threads_flag = {
+    'gold': ['-Wl,--threads', '-Wl,--thread-count=%ARG%'],
+    'lld': '-Wl,--threads=%ARG%',
+    'mold': '-Wl,--thread-count=%ARG%'
+  }
+
+  discard_unused_compile_flag = ['-ffunction-sections', '-fdata-sections']
+  discard_unused_link_flag = '-Wl,--gc-sections'
+  icf_flag = '-Wl,--icf=%ARG%'
+  icf_linkers = ['gold', 'lld', 'mold']
+
+  visibility_hidden_flag = '-fvisibility=hidden'
+  visibility_inlines_hidden_flag = '-fvisibility-inlines-hidden'
+  export_attribute = '__attribute__((visibility("default")))'
+  import_attribute = '__attribute__((visibility("default")))'
+  export_map_flag = '-Wl,--version-script=%ARG%'
+  symbolic_functions_flag = '-Wl,-Bsymbolic-functions'
+  bind_now_flag = '-Wl,-z,now'
+  hash_style_flag = '-Wl,--hash-style=%ARG%'
+
+  bolt_link_flag = '-Wl,--emit-relocs'
+  bolt_optimize_flags = ['-reorder-blocks=ext-tsp', '-reorder-functions=hfsort',
+                         '-split-functions', '-split-all-cold', '-dyno-stats']
+  llvm_bolt = ['llvm-bolt']
+  perf2bolt = ['perf2bolt']
+  perf = ['perf']
+
+  interface_stub = ['nm', '-D', '--defined-only', '-P', '-S', '%ARG%']
+  interface_stub_format = 'nm'
+
+  whole_archive_flag = ['-Wl,--whole-archive', '%ARG%', '-Wl,--no-whole-archive']
+  keep_libraries_begin_flag = '-Wl,--push-state,--no-as-needed'
+  keep_libraries_end_flag = '-Wl,--pop-state'
+
   archiver = ['ar', 'rcs']
   archiver_env = None
   archiver_out = '%ARG%'
+  archiver_thin = ['ar', 'rcsTD']
+  archiver_deterministic_modifier = 'D'
 
   if OS.id == 'darwin':
+    discard_unused_link_flag = '-Wl,-dead_strip'
+    export_map_flag = '-Wl,-exported_symbols_list,%ARG%'
+    llvm_bolt = None  # BOLT only supports ELF binaries.
+    archiver_thin = None  # ld64 can not read thin archives.
+    archiver_deterministic_modifier = None  # Apple's ar has no deterministic mode.
+    interface_stub = None
+    lto_archiver_thin = None
+    whole_archive_flag = '-Wl,-force_load,%ARG%'
+    keep_libraries_begin_flag = []
+    keep_libraries_end_flag = []
+    symbolic_functions_flag = []
+    bind_now_flag = '-Wl,-bind_at_load'
+    hash_style_flag = []
+    icf_linkers = ['lld']
     use_framework = ['-F', '/System/Library/Frameworks', '-framework', '%ARG%']
     compiler_supports_openmp = path.isdir('/usr/local/opt/libomp')
     compiler_enable_openmp = ['-Xpreprocessor', '-fopenmp', '-I/usr/local/opt/libomp/include']
@@ -90,14 +188,110 @@ class GccCompiler(base.Compiler):
     if OS.id == 'darwin':
       session.target_props.add('cxx.osxInstallNameTool', 'StringList')
 
-  def get_compile_command(self, target, data, lang):
-    flags = super().get_compile_command(target, data, lang)
+  def get_compile_command(self, target, data, lang, depfile=True):
+    flags = super().get_compile_command(target, data, lang, depfile)
     if options.enableGcov:
       flags += ['-fprofile-arcs', '-ftest-coverage']
     if OS.id == 'darwin' and options.minversion:
       flags += ['-mmacos-version-min=' + options.minversion]
+    if self.uses_split_dwarf(data):
+      flags += self.expand(self.split_dwarf_flag)
     return flags
 
+  def uses_split_dwarf(self, data):
+    return bool(BUILD.debug and data.separateDebugInformation and
+                self.split_dwarf_flag and OS.id != 'darwin')
+
+  def add_objects_for_source(self, target, data, lang, src, buildset, objdir):
+    super().add_objects_for_source(target, data, lang, src, buildset, objdir)
+    if self.uses_split_dwarf(data):
+      obj = buildset.outputs['obj'][0]
+      buildset.add_output_files('dwo', [path.setsuffix(obj, '.dwo')])
+
+  def get_lto_jobs(self, data):
+    # With -flto=auto (since GCC 10), GCC joins the jobserver of the
+    # calling build tool if there is any and otherwise uses all cores.
+    if options.ltoJobs <= 0 and options.ltoLinkJobs <= 1 and self.version \
+        and int(self.version.split('.')[0]) >= 10:
+      return 'auto'
+    return super().get_lto_jobs(data)
+
+  def select_linker(self, data):
+    linker = super().select_linker(data)
+    if linker == 'lld' and data.lto != 'none':
+      print('[WARNING]: lld can not link GCC LTO objects, using the default linker')
+      return None
+    return linker
+
+  def get_linker_select_flags(self, name):
+    # Probing the linker is expensive, thus we cache the result.
+    cache = self.__dict__.setdefault('_linker_select_flags', {})
+    if name not in cache:
+      flags = self.expand(self.linker_select_flag, name)
+      if not self.check_linker_flags(flags):
+        flags = None
+        if name == 'mold':
+          # GCC before 12.1 does not know -fuse-ld=mold, but mold installs
+          # an `ld` wrapper that GCC picks up with -B.
+          mold = shutil.which('mold')
+          libexec = mold and path.join(path.dir(path.dir(mold)), 'libexec', 'mold')
+          if libexec and self.check_linker_flags(['-B' + libexec]):
+            flags = ['-B' + libexec]
+      cache[name] = flags
+    return cache[name]
+
+  def check_linker_flags(self, flags):
+    """
+    Checks if the compiler driver can invoke the linker with the specified
+    *flags* by asking the linker for its version.
+    """
+
+    command = self.expand(self.linker_c) + flags + ['-Wl,--version']
+    env = dict(os.environ, **self.linker_env) if self.linker_env else None
+    try:
+      subprocess.check_output(command, stderr=subprocess.STDOUT, env=env)
+    except (OSError, subprocess.CalledProcessError):
+      return False
+    return True
+
+  def find_library(self, name, static):
+    # The compiler driver prints the filename unchanged if it does not
+    # find the library in its search path.
+    cache = self.__dict__.setdefault('_find_library', {})
+    if (name, static) not in cache:
+      suffix = self.library_static_suffix if static else self.library_shared_suffix
+      command = self.expand(self.linker_c) + ['-print-file-name=' + self.library_prefix + name + suffix]
+      env = dict(os.environ, **self.linker_env) if self.linker_env else None
+      try:
+        filename = subprocess.check_output(command, stderr=subprocess.DEVNULL, env=env).decode().strip()
+      except (OSError, subprocess.CalledProcessError):
+        filename = None
+      cache[(name, static)] = filename if filename and path.isabs(filename) and path.isfile(filename) else None
+    return cache[(name, static)]
+
+  def get_module_scan_command(self, target, data):
+    command = self.get_compile_command(target, data, 'cpp', depfile=False)
+    command = base.strip_args(command, self.expand(self.compiler_out, '${@obj}'))
+    index = command.index('${<src}')
+    command[index:index] = ['-E', '-x', 'c++']
+    command += ['-MT', '${@ddi}', '-MD', '-MF', '${@ddi}.d']
+    command += ['-fdeps-format=p1689r5', '-fdeps-file=${@ddi}', '-fdeps-target=${obj}']
+    command += ['-o', '${@ddi}.ii']
+    if data._modules.header_unit_mapper:
+      command += self.expand(self.modules_mapper_flag, data._modules.header_unit_mapper)
+    return command, '${@ddi}.d'
+
+  def get_header_unit_commands(self, target, data):
+    command = self.get_compile_command(target, data, 'cpp', depfile=False)
+    command = base.strip_args(command, self.expand(self.compiler_out, '${@obj}'))
+    index = command.index('${<src}')
+    command[index:index+1] = ['-x', 'c++-system-header', '${header}']
+    command += self.expand(self.modules_mapper_flag, data._modules.header_unit_mapper)
+    # The header unit is placed into the repository root by GCC under a
+    # name that we can not predict, thus we produce a stamp file.
+    touch = [sys.executable, '-c', 'import sys; open(sys.argv[1], "w").close()', '${@bmi}']
+    return [command, touch]
+
   def get_link_command(self, target, data, lang):
     flags = super().get_link_command(target, data, lang)
     if data.preferredLinkage == 'shared':
@@ -111,8 +305,26 @@ class GccCompiler(base.Compiler):
     commands = super().get_link_commands(target, data, lang)
     if OS.id == 'darwin' and data.osxInstallNameTool:
       commands.append(['install_name_tool'] + data.osxInstallNameTool + ['${@product}'])
+    if BUILD.debug and data.separateDebugInformation and not base.is_staticlib(data):
+      if OS.id == 'darwin':
+        commands.append(self.dsymutil + ['${@product}', '-o', '${@debug}'])
+      else:
+        # The package must be created before the skeleton debug information
+        # is stripped from the product.
+        if self.uses_split_dwarf(data) and data.packageDebugInformation:
+          commands.append(self.dwp + ['-e', '${@product}', '-o', '${@dwp}'])
+        commands.append(self.objcopy + ['--only-keep-debug', '${@product}', '${@debug}'])
+        commands.append(self.objcopy + ['--strip-debug', '--add-gnu-debuglink=${@debug}', '${@product}'])
     return commands
 
+  def add_link_outputs(self, target, data, lang, buildset):
+    super().add_link_outputs(target, data, lang, buildset)
+    if BUILD.debug and data.separateDebugInformation and not base.is_staticlib(data):
+      suffix = '.dSYM' if OS.id == 'darwin' else '.debug'
+      buildset.add_output_files('debug', [data.productFilename + suffix])
+      if self.uses_split_dwarf(data) and data.packageDebugInformation:
+        buildset.add_output_files('dwp', [data.productFilename + '.dwp'])
+
   def on_completion(self, target, data):
     if options.enableGcov and data.type == 'executable':
       commands = [
@@ -1,5 +1,7 @@
 
 import os
+import subprocess
+import base from './base'
 import {GccCompiler} from './gcc'
 import {LlvmInstallation} from 'net.craftr.compiler.llvm'
 from craftr.api import OS, path
@@ -16,6 +18,91 @@ class LlvmCompiler(GccCompiler):
   linker_c = compiler_c
   linker_cpp = compiler_cpp
 
+  modules_flag = []  # Implied by -std=c++20
+  modules_interface_flag = ['-x', 'c++-module']
+  modules_output_flag = '-fmodule-output=%ARG%'
+  modules_mapper_flag = ['@%ARG%']
+  modules_mapper_format = 'clang'
+  modules_bmi_suffix = '.pcm'
+  modules_scanner = ['clang-scan-deps']
+
+  # Emit address-significance tables so that lld can fold functions safely.
+  discard_unused_compile_flag = GccCompiler.discard_unused_compile_flag + ['-faddrsig']
+
+  time_trace_flag = '-ftime-trace'
+  time_trace_suffix = '.json'
+
+  objcopy = ['llvm-objcopy']
+  if OS.id == 'win32':
+    interface_stub = None
+  elif OS.id != 'darwin':
+    interface_stub = ['llvm-ifs', '--input-format=ELF', '--output-ifs=-', '%ARG%']
+    interface_stub_format = 'text'
+  dwp = ['llvm-dwp']
+
+  lto_compile_flags = {'full': ['-flto'], 'thin': ['-flto=thin']}
+  lto_jobs_flag = '-flto-jobs=%ARG%'
+  lto_archiver = ['llvm-ar', 'rcs']
+  lto_archiver_thin = ['llvm-ar', '--thin', 'rcsD']
+  lto_link_flags = lto_compile_flags
+  if OS.id == 'darwin':
+    lto_cache_flag = '-Wl,-cache_path_lto,%ARG%'
+  else:
+    lto_cache_flag = '-Wl,--thinlto-cache-dir=%ARG%'
+
+  pgo_generate_flag = '-fprofile-instr-generate'
+  pgo_use_flag = '-fprofile-instr-use=%ARG%'
+  pgo_prefix_flag = []
+  pgo_merge = ['llvm-profdata', 'merge']
+  pgo_train_env = {'LLVM_PROFILE_FILE': '%ARG%/default-%p.profraw'}
+
+  def get_lto_jobs(self, data):
+    return base.Compiler.get_lto_jobs(self, data)
+
+  def get_lto_cache_flag(self, data):
+    if OS.id != 'darwin' and data.linker != 'lld':
+      return '-Wl,-plugin-opt,cache-dir=%ARG%'
+    return self.lto_cache_flag
+
+  def select_linker(self, data):
+    linker = base.Compiler.select_linker(self, data)
+    if data.lto == 'none' or OS.id == 'darwin' or linker == 'lld':
+      return linker
+    if self.has_gold_plugin():
+      # BFD, gold and mold read LLVM bitcode through the LLVMgold plugin.
+      return linker
+    if self.get_linker_select_flags('lld') is not None:
+      if linker:
+        print('[WARNING]: linker {!r} can not read LLVM bitcode without the '
+              'LLVMgold plugin, using lld'.format(linker))
+      return 'lld'
+    print('[WARNING]: LTO requires lld or the LLVMgold plugin, disabling LTO')
+    data.lto = 'none'
+    return linker
+
+  def has_gold_plugin(self):
+    cache = self.__dict__
+    if '_has_gold_plugin' not in cache:
+      try:
+        output = subprocess.check_output(self.expand(self.compiler_c) + ['-print-file-name=LLVMgold.so'])
+      except (OSError, subprocess.CalledProcessError):
+        output = b''
+      cache['_has_gold_plugin'] = path.isfile(output.decode().strip())
+    return cache['_has_gold_plugin']
+
+  def get_module_scan_command(self, target, data):
+    command = self.get_compile_command(target, data, 'cpp', depfile=False)
+    command = [x.replace('${@obj}', '${obj}') for x in command]
+    command = base.strip_args(command, self.expand(self.time_trace_flag))
+    return self.modules_scanner + ['-format=p1689', '-o', '${@ddi}', '--'] + command, None
+
+  def get_header_unit_commands(self, target, data):
+    command = self.get_compile_command(target, data, 'cpp', depfile=False)
+    command = base.strip_args(command, self.expand(self.compiler_out, '${@obj}'))
+    index = command.index('${<src}')
+    command[index:index+1] = ['-xc++-system-header', '--precompile', '${header}', '-o', '${@bmi}']
+    return [command]
+
 
 def get_compiler(fragment):
   if OS.id == 'win32':
@@ -14,6 +14,25 @@ class MingwCompiler(GccCompiler):
   library_shared_suffix = '.dll'
   library_static_suffix = '.lib'
 
+  split_dwarf_flag = []  # Not supported for PE/COFF objects.
+  icf_linkers = ['lld']   # GNU ld supports --gc-sections for PE, but no ICF.
+
+  # PE symbols are hidden unless exported, the export map is a .def file.
+  visibility_hidden_flag = []
+  visibility_inlines_hidden_flag = []
+  export_attribute = '__declspec(dllexport)'
+  import_attribute = '__declspec(dllimport)'
+  export_map_flag = '%ARG%'
+  symbolic_functions_flag = []
+  bind_now_flag = []
+  hash_style_flag = []
+  llvm_bolt = None
+  archiver_thin = None
+  interface_stub = None
+  lto_archiver_thin = None
+  keep_libraries_begin_flag = []  # --as-needed only applies to ELF.
+  keep_libraries_end_flag = []
+
   def __init__(self, mingw, **kwargs):
     kwargs.setdefault('arch', 'x64' if mingw.is_64 else 'x86')
     super().__init__(**kwargs)
@@ -55,6 +55,7 @@ class MsvcCompiler(base.Compiler):
   disable_rtti = '/GR-'
   force_include = ['/FI', '%ARG%']
   save_temps = ['/P', '/Fi$out.i']  # TODO: Prevents the compilation step. :(
+  compiler_response_file = '@%ARG%'
 
   compiler_supports_openmp = True
   compiler_enable_openmp = lambda: lambda self: ['-Xclang', '-fopenmp'] if self.is_clang_cl else ['/openmp']
@@ -72,6 +73,23 @@ class MsvcCompiler(base.Compiler):
   #archiver = ['lib', '/nologo']
   archiver_out = '/OUT:${@product}'
 
+  # Removes the timestamps from the objects and binaries.
+  reproducible_compile_flags = ['/Brepro']
+  reproducible_link_flags = ['/Brepro']
+
+  discard_unused_compile_flag = ['/Gy', '/Gw']
+  discard_unused_link_flag = '/OPT:REF'
+  icf_flag = '/OPT:ICF'  # MSVC has no distinction of safe and all.
+
+  export_attribute = '__declspec(dllexport)'
+  import_attribute = '__declspec(dllimport)'
+  export_map_flag = '/DEF:%ARG%'
+  whole_archive_flag = '/WHOLEARCHIVE:%ARG%'
+  link_shared_libraries = False  # Dependents link with the import library.
+
+  lto_compile_flags = {'full': ['/GL']}
+  lto_link_flags = {'full': ['/LTCG']}
+
   def __init__(self, toolkit):
     if toolkit.type == toolkit.TYPE_MSVC:
       name = 'Microsoft Visual C++'
@@ -86,6 +104,7 @@ class MsvcCompiler(base.Compiler):
       linker_c = [toolkit.cl_info.link_program, '/nologo'],
       linker_cpp = [toolkit.cl_info.link_program, '/nologo'],
       archiver = [toolkit.cl_info.lib_program, '/nologo'],
+      lto_archiver = [toolkit.cl_info.lib_program, '/nologo', '/LTCG'],
       version = toolkit.cl_version,
       arch = toolkit.cl_info.target,
       compiler_env = toolkit.environ,
@@ -95,6 +114,11 @@ class MsvcCompiler(base.Compiler):
     )
     self.toolkit = toolkit
     self.is_clang_cl = 'clang' in self.name.lower()
+    if self.is_clang_cl:
+      # lld-link detects LLVM bitcode in the object files automatically.
+      self.lto_compile_flags = {'full': ['-flto'], 'thin': ['-flto=thin']}
+      self.lto_link_flags = {'full': [], 'thin': []}
+      self.lto_cache_flag = '/lldltocache:%ARG%'
 
     for key in self.__fields__:
       value = getattr(self, key)
@@ -135,8 +159,8 @@ class MsvcCompiler(base.Compiler):
       data.defines += ['_WINDLL']
 
   # @override
-  def get_compile_command(self, target, data, lang):
-    command = super().get_compile_command(target, data, lang)
+  def get_compile_command(self, target, data, lang, depfile=True):
+    command = super().get_compile_command(target, data, lang, depfile)
 
     # Translate a potentially unknown C++ standard name for MSVC.
     if data.cppStd == 'c++17':
@@ -170,10 +194,15 @@ class MsvcCompiler(base.Compiler):
       arg = '/Zc:' + conf
       command.append(arg)
 
-    if self.deps_prefix:
+    if self.deps_prefix and depfile:
       command += ['/showIncludes']
     return command
 
+  # @override
+  def quote_response_file_arg(self, arg):
+    # Backslashes are only special in front of a quote for cl.
+    return '"' + arg.replace('"', '\\"') + '"'
+
   # @override
   def add_objects_for_source(self, target, data, lang, src, buildset, objdir):
     super().add_objects_for_source(target, data, lang, src, buildset, objdir)
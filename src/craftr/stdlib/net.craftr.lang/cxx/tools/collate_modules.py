@@ -0,0 +1,165 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+"""
+Collates the P1689 module dependency files produced by the C++ module scan
+step of a target. Generates a dyndep file that tells the build backend which
+BMIs a translation unit depends on, a module map for every translation unit
+that tells the compiler where to find (or place) BMIs, and a JSON file that
+describes the modules provided by the target for dependent targets.
+
+The tool receives a plan file that is generated by the cxx module when the
+build is configured.
+"""
+
+import argparse
+import json
+import nr.fs
+import sys
+
+from craftr.core import dyndep
+
+
+class CollateError(Exception):
+  pass
+
+
+def load_json(filename):
+  with open(filename) as fp:
+    return json.load(fp)
+
+
+def write_if_changed(filename, content):
+  with nr.fs.mtime_consistent_file(filename, 'w') as fp:
+    fp.write(content)
+
+
+def is_header_unit(name):
+  return name.startswith('<') or name.startswith('"')
+
+
+def collate(plan):
+  # Modules provided by dependencies, mapping names to BMIs and the
+  # closure of modules that the BMI depends on.
+  bmis = {}
+  closures = {}
+  for filename in plan['deps']:
+    for name, info in load_json(filename)['modules'].items():
+      bmis[name] = info['bmi']
+      closures[name] = info['closure']
+
+  # Read the scan results of our own translation units.
+  units = []
+  local = {}
+  for source in plan['sources']:
+    provides, requires = [], []
+    for rule in load_json(source['ddi']).get('rules', []):
+      provides += [x['logical-name'] for x in rule.get('provides', [])]
+      requires += [x['logical-name'] for x in rule.get('requires', [])]
+    if len(provides) > 1:
+      raise CollateError('{} provides more than one module'.format(source['src']))
+    for name in provides:
+      if not source['bmi']:
+        raise CollateError('{} provides module "{}" but is not a module interface '
+          'unit (add it to cxx.moduleInterfaces)'.format(source['src'], name))
+      if name in local or name in bmis:
+        raise CollateError('module "{}" is provided more than once'.format(name))
+      local[name] = source
+      bmis[name] = source['bmi']
+    units.append((source, provides, requires))
+
+  requires_of = {}
+  for source, provides, requires in units:
+    for name in provides:
+      requires_of[name] = [x for x in requires if not is_header_unit(x)]
+
+  def closure(name, stack=()):
+    if name in closures:
+      return closures[name]
+    if name in stack:
+      raise CollateError('cyclic module imports: {}'.format(' -> '.join(stack + (name,))))
+    if name not in requires_of:
+      raise CollateError('unknown module "{}"'.format(name))
+    result = {}
+    for dep in requires_of[name]:
+      if dep not in bmis:
+        raise CollateError('unknown module "{}" imported by "{}"'.format(dep, name))
+      result[dep] = bmis[dep]
+      result.update(closure(dep, stack + (name,)))
+    closures[name] = result
+    return result
+
+  entries = {}
+  for source, provides, requires in units:
+    imports = {}
+    for name in requires:
+      if is_header_unit(name):
+        if name[1:-1] not in plan['header_units']:
+          raise CollateError('{} imports header unit {} which is not listed in '
+            'cxx.headerUnits'.format(source['src'], name))
+        continue
+      if name not in bmis:
+        raise CollateError('{} imports unknown module "{}"'.format(source['src'], name))
+      imports[name] = bmis[name]
+      imports.update(closure(name))
+
+    lines = []
+    if plan['format'] == 'gcc':
+      if plan['header_unit_dir']:
+        lines.append('$root {}'.format(plan['header_unit_dir']))
+      for name in provides:
+        lines.append('{} {}'.format(name, source['bmi']))
+      for name, bmi in sorted(imports.items()):
+        lines.append('{} {}'.format(name, bmi))
+    elif plan['format'] == 'clang':
+      for name, bmi in sorted(imports.items()):
+        lines.append('"-fmodule-file={}={}"'.format(name, bmi))
+      for name, bmi in sorted(plan['header_units'].items()):
+        lines.append('"-fmodule-file={}"'.format(bmi))
+    else:
+      raise CollateError('unsupported module map format: {!r}'.format(plan['format']))
+    write_if_changed(source['modmap'], ''.join(x + '\n' for x in lines))
+    entries[source['obj']] = dyndep.Entry(sorted(set(imports.values())), [])
+
+  dyndep.dump(entries, plan['dyndep'])
+
+  modules = {name: {'bmi': source['bmi'], 'closure': closure(name)}
+             for name, source in local.items()}
+  write_if_changed(plan['modules'], json.dumps({'modules': modules}, indent=2, sort_keys=True))
+
+
+def main(argv=None):
+  parser = argparse.ArgumentParser()
+  parser.add_argument('plan', help='The plan file generated by the cxx module.')
+  args = parser.parse_args(argv)
+  try:
+    collate(load_json(args.plan))
+  except CollateError as exc:
+    print('fatal:', exc, file=sys.stderr)
+    return 1
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -0,0 +1,87 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+"""
+Writes the interface stub of a shared library, a text file that describes
+the symbols that it exports, from the output of a command such as `nm` or
+`llvm-ifs`. The stub is only touched if its content changes, so that the
+targets that link with the library and depend on its stub are only relinked
+if the exported interface changed.
+
+With `--format=nm`, the command must produce POSIX `nm` output with symbol
+sizes (`nm -D --defined-only -P -S`). The addresses of the symbols are
+dropped, as they change with every change to the implementation. So are the
+sizes of functions, only the sizes of data objects are kept (like llvm-ifs).
+"""
+
+import argparse
+import nr.fs
+import subprocess
+import sys
+
+
+# The nm symbol types of data objects. The size of a data object is part of
+# the ABI, the size of a function changes with every edit of its body.
+DATA_SYMBOL_TYPES = 'BDGRSV'
+
+
+def parse_nm(output):
+  lines = set()
+  for line in output.splitlines():
+    parts = line.split()
+    if len(parts) < 2:
+      continue
+    name, kind = parts[:2]
+    size = parts[3] if len(parts) > 3 and kind.upper() in DATA_SYMBOL_TYPES else ''
+    lines.add(' '.join(filter(None, [name, kind, size])))
+  return ''.join(x + '\n' for x in sorted(lines))
+
+
+def main(argv=None):
+  parser = argparse.ArgumentParser()
+  parser.add_argument('-o', '--output', required=True, help='The interface stub to produce.')
+  parser.add_argument('--format', choices=('nm', 'text'), default='text',
+    help='The format of the command output.')
+  parser.add_argument('command', nargs=argparse.REMAINDER,
+    help='The command that prints the interface. Must be preceded by --.')
+  args = parser.parse_args(argv)
+
+  command = args.command[1:] if args.command[:1] == ['--'] else args.command
+  if not command:
+    parser.error('missing command')
+  try:
+    output = subprocess.check_output(command).decode('utf8', 'replace')
+  except subprocess.CalledProcessError as exc:
+    return exc.returncode
+
+  if args.format == 'nm':
+    output = parse_nm(output)
+  nr.fs.makedirs(nr.fs.dir(args.output))
+  with nr.fs.mtime_consistent_file(args.output, 'w') as fp:
+    fp.write(output)
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
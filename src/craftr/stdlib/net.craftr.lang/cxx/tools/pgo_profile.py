@@ -0,0 +1,91 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+"""
+Produces the profile that is consumed by the optimized build of a target
+with `cxx.pgo=train` from the raw profile data written by the training run.
+
+If a merge command is specified (eg. `llvm-profdata merge`), it is invoked
+with the raw profile files and its output replaces the output file. Without
+a merge command (eg. for GCC, which reads the `.gcda` files directly), a
+digest of the raw profile data is written to the output file instead.
+
+In both cases, the output file is only touched if its content changes, so
+that the optimized build is only repeated if the profile actually changed.
+"""
+
+import argparse
+import hashlib
+import nr.fs
+import os
+import subprocess
+import sys
+
+
+def list_files(directory):
+  result = []
+  for root, dirs, files in os.walk(directory):
+    dirs.sort()
+    result += [os.path.join(root, x) for x in sorted(files)]
+  return result
+
+
+def main(argv=None):
+  parser = argparse.ArgumentParser()
+  parser.add_argument('output', help='The profile (or digest) file to produce.')
+  parser.add_argument('rawdir', help='The directory that contains the raw profile data.')
+  parser.add_argument('merge', nargs=argparse.REMAINDER,
+    help='The command to merge the raw profiles. Must be preceded by --.')
+  args = parser.parse_args(argv)
+
+  files = list_files(args.rawdir)
+  if not files:
+    print('error: no profile data in "{}", did the training run succeed?'.format(args.rawdir), file=sys.stderr)
+    return 1
+
+  merge = args.merge[1:] if args.merge[:1] == ['--'] else args.merge
+  if merge:
+    temp = args.output + '.tmp'
+    res = subprocess.call(merge + ['-o', temp] + files)
+    if res != 0:
+      return res
+    with open(temp, 'rb') as fp:
+      content = fp.read()
+    os.remove(temp)
+  else:
+    hasher = hashlib.sha1()
+    for filename in files:
+      hasher.update(os.path.relpath(filename, args.rawdir).encode('utf8'))
+      with open(filename, 'rb') as fp:
+        hasher.update(hashlib.sha1(fp.read()).digest())
+    content = (hasher.hexdigest() + '\n').encode('ascii')
+
+  nr.fs.makedirs(nr.fs.dir(args.output))
+  with nr.fs.mtime_consistent_file(args.output, 'wb') as fp:
+    fp.write(content)
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
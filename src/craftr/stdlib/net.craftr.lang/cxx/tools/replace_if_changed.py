@@ -0,0 +1,51 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+"""
+Moves the file *src* to *dst* if their contents differ and removes *src*
+otherwise. Used together with restat, so that the build steps that depend
+on *dst* are only repeated if its content actually changed.
+"""
+
+import filecmp
+import os
+import sys
+
+
+def main(argv=None):
+  if argv is None:
+    argv = sys.argv[1:]
+  if len(argv) != 2:
+    print('usage: replace_if_changed.py src dst', file=sys.stderr)
+    return 1
+  src, dst = argv
+  if os.path.isfile(dst) and filecmp.cmp(src, dst, shallow=False):
+    os.remove(src)
+  else:
+    os.replace(src, dst)
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -24,33 +24,25 @@
 """
 A small tool to augment the MANIFEST.MF in a JAR file and add files to it or
 remove files from it.
+
+With `--reproducible`, all entries get the timestamp of the
+`SOURCE_DATE_EPOCH` environment variable (but not before 1980, the minimum
+of the ZIP format) and fixed permissions, and they are ordered by name with
+the manifest first. The output then only depends on the contents.
 """
 
 import argparse
 import errno
 import codecs
 import contextlib
+import io
 import os
 import shutil
 import sys
-import tempfile
+import time
 import zipfile
 
 
-@contextlib.contextmanager
-def named_tempfile(*args, **kwargs):
-  kwargs.setdefault('delete', False)
-  fp = tempfile.NamedTemporaryFile(*args, **kwargs)
-  try:
-    yield fp
-  finally:
-    try:
-      os.remove(fp.name)
-    except OSError as e:
-      if e.errno != errno.ENOENT:
-        raise
-
-
 def parse_manifest(fp):
   """
   Parses a Java manifest file.
@@ -70,6 +62,49 @@ def write_manifest(fp, data):
     fp.write('{}: {}\n'.format(key, value))
 
 
+def get_date_time():
+  epoch = max(int(os.environ.get('SOURCE_DATE_EPOCH', 0)), 315532800)  # 1980-01-01
+  return time.gmtime(epoch)[:6]
+
+
+def entry_order(name):
+  # The manifest must be the first entry, followed by the META-INF/ directory.
+  return (name != 'META-INF/MANIFEST.MF', not name.startswith('META-INF/'), name)
+
+
+def write_entry(outjar, name, source, date_time=None):
+  """
+  Writes the entry *name* to *outjar*. The *source* is the data, the name
+  of a file or a pair of a #zipfile.ZipFile and the name of the entry to
+  copy, whose contents are streamed into the archive. If *date_time* is
+  specified, the entry gets that timestamp and fixed permissions.
+  """
+
+  if date_time is None and isinstance(source, str):
+    outjar.write(source, name)
+    return
+  if date_time is None and isinstance(source, tuple):
+    date_time = source[0].getinfo(source[1]).date_time
+
+  is_dir = name.endswith('/') or (isinstance(source, str) and os.path.isdir(source))
+  if is_dir and not name.endswith('/'):
+    name += '/'
+  info = zipfile.ZipInfo(name, date_time or time.localtime()[:6])
+  info.external_attr = (0o40755 << 16 | 0x10) if is_dir else (0o644 << 16)
+  info.compress_type = zipfile.ZIP_STORED if is_dir else outjar.compression
+
+  if is_dir or isinstance(source, bytes):
+    outjar.writestr(info, b'' if is_dir else source)
+    return
+  with contextlib.ExitStack() as stack:
+    if isinstance(source, str):
+      src = stack.enter_context(open(source, 'rb'))
+    else:
+      src = stack.enter_context(source[0].open(source[1]))
+    dst = stack.enter_context(outjar.open(info, 'w'))
+    shutil.copyfileobj(src, dst)
+
+
 def main():
   parser = argparse.ArgumentParser(description="Augment/merge JAR files.")
   parser.add_argument('jar', help='The input JAR file.')
@@ -93,6 +128,8 @@ def main():
       'with --put-file when a file already exists.')
   parser.add_argument('--force', action='store_true', help='Don\'t error '
       'with --rem-file if the file does not exist in the JAR.')
+  parser.add_argument('--reproducible', action='store_true', help='Write the '
+      'entries with fixed timestamps and permissions in a fixed order.')
   parser.add_argument('-v', '--verbose', action='store_true')
   args = parser.parse_args()
 
@@ -150,7 +187,8 @@ def main():
     utf8reader = codecs.getreader('utf8')
     utf8writer = codecs.getwriter('utf8')
     with zipfile.ZipFile(args.jar, mode='r') as injar, \
-         zipfile.ZipFile(args.output, mode='w', compression=compression) as outjar:
+         zipfile.ZipFile(args.output, mode='w', compression=compression) as outjar, \
+         contextlib.ExitStack() as stack:
       namelist = injar.namelist()
 
       # Read the manifest file.
@@ -175,67 +213,72 @@ def main():
       # A list of the files already added to the archive.
       collected_names = []
 
+      # The entries to write, as pairs of the name and the source (see
+      # write_entry()). The JARs to merge stay open until the entries are
+      # written, so that their contents are not held in memory.
+      entries = []
+
       # Copy all files to the output archive.
       for current in [(injar, namelist)] + args.merge:
-        with contextlib.ExitStack() as stack:
-          if isinstance(current, str):
-            # A JAR file from the list of files to merge.
-            curr_jar = stack.enter_context(zipfile.ZipFile(current, 'r'))
-            curr_namelist = curr_jar.namelist()
-            skip_meta_inf = True
+        if isinstance(current, str):
+          # A JAR file from the list of files to merge.
+          curr_jar = stack.enter_context(zipfile.ZipFile(current, 'r'))
+          curr_namelist = curr_jar.namelist()
+          skip_meta_inf = True
+        else:
+          # The original input JAR file.
+          curr_jar, curr_namelist = current
+          skip_meta_inf = False
+
+        for name in curr_namelist:
+          if skip_meta_inf and name.startswith('META-INF/'):
+            continue
+          if not name.endswith('/') and name in collected_names:
+            print('fatal: duplicate entry: {!r}'.format(name))
+            continue
+
+          # Check if one of the rem_files excludes this file by a whole
+          # directory.
+          excluded = any(name == x or (x.endswith('/') and name.startswith(x))
+                        for x in rem_files)
+          if excluded:
+            if args.verbose:
+              print('skipped:', name)
+            continue
+          if name in put_files:
+            if args.verbose:
+              print('skipped (from {}):'.format(put_files[name]), name)
+            continue
+          if name.endswith('/'):
+            continue
+
+          # Special case, write the manifest data that we modified.
+          if name == 'META-INF/MANIFEST.MF':
+            fp = io.BytesIO()
+            write_manifest(utf8writer(fp), manifest)
+            entries.append((name, fp.getvalue()))
+
+          # Otherwise just copy the whole file contents.
           else:
-            # The original input JAR file.
-            curr_jar, curr_namelist = current
-            skip_meta_inf = False
-
-          for name in curr_namelist:
-            if skip_meta_inf and name.startswith('META-INF/'):
-              continue
-            if not name.endswith('/') and name in collected_names:
-              print('fatal: duplicate entry: {!r}'.format(name))
-              continue
-
-            # Check if one of the rem_files excludes this file by a whole
-            # directory.
-            excluded = any(name == x or (x.endswith('/') and name.startswith(x))
-                          for x in rem_files)
-            if excluded:
-              if args.verbose:
-                print('skipped:', name)
-              continue
-            if name in put_files:
-              if args.verbose:
-                print('skipped (from {}):'.format(put_files[name]), name)
-              continue
-            if name.endswith('/'):
-              continue
-
-            # Special case, write the manifest data that we modified.
-            if name == 'META-INF/MANIFEST.MF':
-              with named_tempfile() as fp:
-                write_manifest(utf8writer(fp), manifest)
-                fp.close()
-                outjar.write(fp.name, name)
-
-            # Otherwise just copy the whole file contents.
-            else:
-              with curr_jar.open(name) as src:
-                with named_tempfile() as tmp:
-                  shutil.copyfileobj(src, tmp)
-                  tmp.close()
-                  outjar.write(tmp.name, name)
+            entries.append((name, (curr_jar, name)))
 
-            if args.verbose:
-              print('copied:', name)
+          if args.verbose:
+            print('copied:', name)
 
         collected_names += curr_namelist
 
-      # Write all new files into the archive.
+      # Add all new files to the archive.
       for name, source in put_files.items():
-        outjar.write(source, name)
+        entries.append((name, source))
         if args.verbose:
           print('copied:', name, '(from {})'.format(source))
 
+      date_time = get_date_time() if args.reproducible else None
+      if args.reproducible:
+        entries.sort(key=lambda x: entry_order(x[0]))
+      for name, source in entries:
+        write_entry(outjar, name, source, date_time)
+
     if original:
       os.remove(original)
   except:
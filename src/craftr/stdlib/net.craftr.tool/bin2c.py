@@ -193,6 +193,8 @@ def get_argument_parser(prog=None):
   group.add_argument('-s', '--static', action='store_true', help='Write to header as static data.')
   group.add_argument('--cstring', action='store_true', help='Write a C-string representation (precedence over --cppstring).')
   group.add_argument('--cppstring', action='store_true', help='Write a C++-string representation.')
+  group.add_argument('--sort', action='store_true', help='Write the files ordered by their symbol '
+    'name instead of the order on the command-line.')
 
   return parser
 
@@ -207,6 +209,8 @@ def main(argv=None, prog=None):
     if not s:
       s = re.sub('[^\w\d_]+', '_', os.path.basename(f))
     files[f] = s
+  if args.sort:
+    files = collections.OrderedDict(sorted(files.items(), key=lambda x: x[1]))
 
   if args.h:
     with open_cli_file(args.h, 'w') as fp:
@@ -0,0 +1,174 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""
+A lightweight server for the remote action cache (see the
+`build:remoteCache` option). It stores the entries in a directory with the
+same layout as bazel-remote's HTTP interface:
+
+    $ craftr --tool cache-server --port 8080 --directory /var/cache/craftr
+    $ craftr -b -Obuild:remoteCache=http://localhost:8080
+
+`GET`, `HEAD` and `PUT` requests are supported on `/ac/<key>` and
+`/cas/<sha256>`. Uploads to `/cas/` are rejected if the contents do not
+match the digest. With `--read-only`, all uploads are rejected.
+
+The server listens on `127.0.0.1` by default. Uploads can be restricted to
+clients that send the token from `--token-file` (or the `CRAFTR_CACHE_TOKEN`
+environment variable) in an `Authorization: Bearer <token>` header. The
+build picks the token up from the same environment variable. Listening on
+another address requires a token or `--read-only`, as anyone who can write
+to the action cache can inject outputs into other builds.
+"""
+
+import argparse
+import hashlib
+import hmac
+import http.server
+import os
+import re
+import socketserver
+import sys
+
+KEY_REGEX = re.compile(r'^/(ac|cas)/([0-9a-f]{64})$')
+TOKEN_ENVIRON_KEY = 'CRAFTR_CACHE_TOKEN'
+LOCAL_HOSTS = ('127.0.0.1', 'localhost', '::1')
+
+
+def get_token(token_file=None):
+  if token_file:
+    with open(token_file) as fp:
+      return fp.read().strip() or None
+  return os.environ.get(TOKEN_ENVIRON_KEY) or None
+
+
+class ThreadingHTTPServer(socketserver.ThreadingMixIn, http.server.HTTPServer):
+  # Same as http.server.ThreadingHTTPServer, which requires Python 3.7.
+  daemon_threads = True
+
+
+class CacheRequestHandler(http.server.BaseHTTPRequestHandler):
+
+  directory = None
+  read_only = False
+  token = None
+  quiet = False
+
+  def get_filename(self):
+    match = KEY_REGEX.match(self.path)
+    if not match:
+      return None, None
+    kind, key = match.groups()
+    return os.path.join(self.directory, kind, key[:2], key), (kind, key)
+
+  def send_empty(self, code):
+    self.send_response(code)
+    self.send_header('Content-Length', '0')
+    self.end_headers()
+
+  def is_authorized(self):
+    if not self.token:
+      return True
+    header = self.headers.get('Authorization', '')
+    return hmac.compare_digest(header.encode('utf8'), 'Bearer {}'.format(self.token).encode('utf8'))
+
+  def do_HEAD(self):
+    self.do_GET(send_body=False)
+
+  def do_GET(self, send_body=True):
+    filename = self.get_filename()[0]
+    if not filename:
+      return self.send_empty(400)
+    try:
+      with open(filename, 'rb') as fp:
+        data = fp.read()
+    except FileNotFoundError:
+      return self.send_empty(404)
+    self.send_response(200)
+    self.send_header('Content-Type', 'application/octet-stream')
+    self.send_header('Content-Length', str(len(data)))
+    self.end_headers()
+    if send_body:
+      self.wfile.write(data)
+
+  def do_PUT(self):
+    filename, key = self.get_filename()
+    if not filename:
+      return self.send_empty(400)
+    if self.read_only:
+      return self.send_empty(403)
+    if not self.is_authorized():
+      return self.send_empty(401)
+    data = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+    if key[0] == 'cas' and hashlib.sha256(data).hexdigest() != key[1]:
+      return self.send_empty(400)
+    os.makedirs(os.path.dirname(filename), exist_ok=True)
+    temp = '{}.{}.tmp'.format(filename, id(self))
+    with open(temp, 'wb') as fp:
+      fp.write(data)
+    os.replace(temp, filename)
+    self.send_empty(200)
+
+  def log_message(self, *args):
+    if not self.quiet:
+      super().log_message(*args)
+
+
+def get_argument_parser(prog=None):
+  parser = argparse.ArgumentParser(prog=prog)
+  parser.add_argument('--host', default='127.0.0.1', help='The address to listen on.')
+  parser.add_argument('--port', type=int, default=8080, help='The port to listen on.')
+  parser.add_argument('--directory', default='craftr-cache-server',
+    help='The directory to store the cache entries in.')
+  parser.add_argument('--read-only', action='store_true', help='Reject all uploads.')
+  parser.add_argument('--token-file', help='A file that contains the token that is required '
+    'for uploads. Defaults to the {} environment variable.'.format(TOKEN_ENVIRON_KEY))
+  parser.add_argument('-q', '--quiet', action='store_true', help='Do not log requests.')
+  return parser
+
+
+def main(argv=None, prog=None):
+  parser = get_argument_parser(prog)
+  args = parser.parse_args(argv)
+  token = get_token(args.token_file)
+  if args.host not in LOCAL_HOSTS and not token and not args.read_only:
+    parser.error('listening on {} requires --token-file or --read-only'.format(args.host))
+  handler = type('Handler', (CacheRequestHandler,), {
+    'directory': os.path.abspath(args.directory),
+    'read_only': args.read_only,
+    'token': token,
+    'quiet': args.quiet})
+  server = ThreadingHTTPServer((args.host, args.port), handler)
+  print('cache server listening on {}:{} ({})'.format(args.host, args.port, handler.directory))
+  sys.stdout.flush()
+  try:
+    server.serve_forever()
+  except KeyboardInterrupt:
+    pass
+  finally:
+    server.server_close()
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
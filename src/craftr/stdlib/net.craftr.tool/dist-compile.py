@@ -0,0 +1,511 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""
+Distributed compilation for the C and C++ compile steps of the cxx module.
+Worker daemons compile preprocessed sources that they receive over TCP:
+
+    $ craftr --tool dist-compile serve [--host HOST] [--port 4020] [--jobs N]
+        [--secret-file FILE]
+
+If the `cxx:distribute` option lists workers (`host:port`, separated by
+commas), the cxx module runs its compile commands through the `compile`
+subcommand. It preprocesses the source locally, writing the depfile at the
+same time, and sends it to the worker with the lowest load that has a
+compiler with the same identity (version and target). The object file and
+the compiler output are sent back. The command runs locally instead if no
+worker is available or if it uses features that produce other outputs than
+the object and depfile (eg. C++20 modules, split DWARF or profiling).
+
+Since the compile steps mostly wait for the workers, more of them should be
+run in parallel than there are local cores (eg. `ninja -j`).
+
+Workers listen on 127.0.0.1 unless another `--host` is specified, which
+requires a shared secret (`--secret-file` or the `CRAFTR_DIST_COMPILE_SECRET`
+environment variable). The client signs the compile requests with the secret
+from the same environment variable. Workers only run a compiler from their
+PATH that has the same identity as the client's, and only with the compile
+options in #is_allowed_arg(), as other options can load plugins or run
+other programs (eg. `-fplugin`, `-wrapper` or `-B`).
+"""
+
+import argparse
+import hashlib
+import hmac
+import json
+import os
+import shlex
+import shutil
+import socket
+import socketserver
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+
+DEFAULT_PORT = 4020
+SECRET_ENVIRON_KEY = 'CRAFTR_DIST_COMPILE_SECRET'
+
+# Options of the GCC compatible compiler drivers that take the value as the
+# next argument.
+OPTIONS_WITH_VALUE = {'-o', '-x', '-include', '-imacros', '-isystem', '-iquote',
+  '-idirafter', '-iprefix', '-MF', '-MT', '-MQ', '-F', '-framework', '-arch',
+  '-Xpreprocessor', '-Xclang', '-target', '--target'}
+
+# Preprocessor options that are not passed on to the worker. The option
+# names in the second set take their value as the next argument.
+PREPROCESSOR_PREFIXES = ('-I', '-D', '-U', '-MMD', '-MD', '-MP', '-MF', '-MT', '-MQ')
+PREPROCESSOR_WITH_VALUE = {'-include', '-imacros', '-isystem', '-iquote', '-idirafter',
+  '-iprefix', '-MF', '-MT', '-MQ', '-Xpreprocessor'}
+
+# Options that produce additional outputs or read files at compile time,
+# commands with these options are compiled locally.
+LOCAL_ONLY_PREFIXES = ('-fmodule', '-fmodules', '-fdeps-', '-ftime-trace', '-gsplit-dwarf',
+  '-fprofile', '-fcoverage', '-ftest-coverage', '-fprofile-arcs', '--coverage',
+  '-save-temps', '-x', '-fembed-bitcode', '@')
+
+
+# The options that a worker accepts, the preprocessor options are stripped
+# by the client. Everything else is rejected.
+ALLOWED_ARGS = {'-w', '-pedantic', '-pedantic-errors', '-ansi', '-pipe', '-pthread'}
+ALLOWED_PREFIXES = ('-O', '-g', '-W', '-m', '-std=', '--target=')
+FORBIDDEN_PREFIXES = ('-Wa,', '-Wp,', '-Wl,', '-gsplit-dwarf', '-mllvm')
+
+# The `-f` options that a worker accepts, without the `no-` prefix and the
+# `=value` suffix. Many `-f` options load plugins or write files next to the
+# output (eg. `-fpass-plugin=` or `-foptimization-record-file=`), thus only
+# code generation, language and diagnostic options are allowed.
+ALLOWED_F_OPTIONS = {
+  # Code generation
+  'pic', 'PIC', 'pie', 'PIE', 'plt', 'common', 'exceptions', 'cxx-exceptions',
+  'rtti', 'asynchronous-unwind-tables', 'unwind-tables', 'omit-frame-pointer',
+  'stack-protector', 'stack-protector-strong', 'stack-protector-all',
+  'stack-clash-protection', 'cf-protection', 'trivial-auto-var-init',
+  'visibility', 'visibility-inlines-hidden', 'semantic-interposition',
+  'function-sections', 'data-sections', 'lto', 'whole-program-vtables',
+  'strict-vtable-pointers', 'strict-aliasing', 'strict-overflow', 'strict-enums',
+  'wrapv', 'trapv', 'fast-math', 'finite-math-only', 'math-errno', 'builtin',
+  'inline', 'inline-functions', 'unroll-loops', 'tree-vectorize', 'vectorize',
+  'slp-vectorize', 'jump-tables', 'optimize-sibling-calls', 'merge-all-constants',
+  'zero-initialized-in-bss', 'align-functions', 'sanitize', 'sanitize-recover',
+  'openmp', 'openmp-simd', 'signed-char', 'unsigned-char', 'short-enums',
+  'debug-types-section', 'standalone-debug', 'limit-debug-info',
+  'debug-prefix-map', 'file-prefix-map', 'macro-prefix-map', 'ident',
+  # Language
+  'permissive', 'threadsafe-statics', 'use-cxa-atexit', 'sized-deallocation',
+  'aligned-allocation', 'aligned-new', 'char8_t', 'coroutines', 'concepts',
+  'gnu-keywords', 'elide-constructors', 'delayed-template-parsing',
+  'ms-extensions', 'ms-compatibility', 'ms-compatibility-version', 'declspec',
+  'constexpr-depth', 'constexpr-steps', 'constexpr-ops-limit', 'template-depth',
+  # Diagnostics
+  'diagnostics-color', 'color-diagnostics', 'diagnostics-show-option',
+  'diagnostics-format', 'diagnostics-absolute-paths', 'caret-diagnostics',
+  'show-column', 'message-length', 'max-errors', 'error-limit', 'syntax-only'}
+
+
+def is_allowed_arg(arg):
+  """
+  Returns #True if the compile option *arg* may be executed by a worker.
+  """
+
+  if arg in ALLOWED_ARGS:
+    return True
+  if arg.startswith('-f'):
+    name = arg[2:].partition('=')[0]
+    if name.startswith('no-'):
+      name = name[3:]
+    return name in ALLOWED_F_OPTIONS
+  return arg.startswith(ALLOWED_PREFIXES) and not arg.startswith(FORBIDDEN_PREFIXES)
+
+
+def get_secret():
+  secret = os.environ.get(SECRET_ENVIRON_KEY)
+  return secret.encode('utf8') if secret else None
+
+
+def sign(secret, header, payload):
+  """
+  Returns the signature of a compile request with the shared *secret*.
+  """
+
+  data = json.dumps({k: v for k, v in header.items() if k not in ('signature', 'payload_size')},
+                    sort_keys=True)
+  data = data.encode('utf8') + hashlib.sha256(payload).digest()
+  return hmac.new(secret, data, hashlib.sha256).hexdigest()
+
+
+def send_message(sock, header, payload=b''):
+  data = json.dumps(dict(header, payload_size=len(payload))).encode('utf8')
+  sock.sendall(struct.pack('!I', len(data)) + data + payload)
+
+
+def recv_exact(sock, size):
+  chunks = []
+  while size > 0:
+    data = sock.recv(min(size, 1 << 20))
+    if not data:
+      raise ConnectionError('connection closed')
+    chunks.append(data)
+    size -= len(data)
+  return b''.join(chunks)
+
+
+def recv_message(sock):
+  size = struct.unpack('!I', recv_exact(sock, 4))[0]
+  header = json.loads(recv_exact(sock, size).decode('utf8'))
+  return header, recv_exact(sock, header['payload_size'])
+
+
+def get_identity(compiler):
+  """
+  Returns a hash of the version and target of the *compiler*. Workers only
+  compile with a compiler that has the same identity as the local one. The
+  identity is cached in a directory of the current user until the compiler
+  changes.
+  """
+
+  program = shutil.which(compiler)
+  if not program:
+    return None
+  stat = os.stat(program)
+  key = '{}:{}:{}'.format(os.path.realpath(program), stat.st_mtime, stat.st_size)
+  cache_dir = os.path.join(os.environ.get('XDG_CACHE_HOME') or
+    os.path.join(os.path.expanduser('~'), '.cache'), 'craftr', 'dist-compile')
+  os.makedirs(cache_dir, mode=0o700, exist_ok=True)
+  cache = os.path.join(cache_dir, hashlib.sha1(key.encode('utf8')).hexdigest())
+  try:
+    with open(cache) as fp:
+      return fp.read().strip()
+  except OSError:
+    pass
+  try:
+    output = subprocess.check_output([program, '--version'], stderr=subprocess.STDOUT)
+    output += subprocess.check_output([program, '-dumpmachine'], stderr=subprocess.STDOUT)
+  except (OSError, subprocess.CalledProcessError):
+    return None
+  identity = hashlib.sha1(output).hexdigest()
+  with open(cache, 'w') as fp:
+    fp.write(identity)
+  return identity
+
+
+# Worker
+# ======
+
+class Worker(socketserver.ThreadingTCPServer):
+
+  daemon_threads = True
+  allow_reuse_address = True
+
+  def __init__(self, address, jobs, secret=None):
+    super().__init__(address, WorkerHandler)
+    self.jobs = jobs
+    self.secret = secret
+    self.active = 0
+    self.lock = threading.Lock()
+    self.identities = {}
+
+  def acquire(self):
+    with self.lock:
+      if self.active >= self.jobs:
+        return False
+      self.active += 1
+      return True
+
+  def release(self):
+    with self.lock:
+      self.active -= 1
+
+  def get_identity(self, compiler):
+    if compiler not in self.identities:
+      self.identities[compiler] = get_identity(compiler)
+    return self.identities[compiler]
+
+
+class WorkerHandler(socketserver.BaseRequestHandler):
+
+  def handle(self):
+    try:
+      header, payload = recv_message(self.request)
+    except (ConnectionError, ValueError, struct.error):
+      return
+    if header.get('type') == 'status':
+      send_message(self.request, {'load': self.server.active, 'jobs': self.server.jobs})
+    elif header.get('type') == 'compile':
+      send_message(self.request, *self.compile(header, payload))
+    else:
+      send_message(self.request, {'status': 'error', 'message': 'invalid request'})
+
+  def compile(self, header, source):
+    secret = self.server.secret
+    if secret and not hmac.compare_digest(str(header.get('signature')), sign(secret, header, source)):
+      return {'status': 'denied'},
+    compiler = header['compiler']
+    args = header['args']
+    if not isinstance(args, list) or not all(isinstance(x, str) and is_allowed_arg(x) for x in args):
+      return {'status': 'denied'},
+    if header['suffix'] not in ('.i', '.ii'):
+      return {'status': 'denied'},
+    # Only compilers from the PATH of the worker can be used.
+    identity = self.server.get_identity(compiler) if os.path.basename(compiler) == compiler else None
+    if not identity or header['identity'] != identity:
+      return {'status': 'toolchain'},
+    if not self.server.acquire():
+      return {'status': 'busy'},
+    try:
+      with tempfile.TemporaryDirectory(prefix='craftr-dist-compile-') as tmpdir:
+        src = os.path.join(tmpdir, 'source' + header['suffix'])
+        obj = os.path.join(tmpdir, 'source.o')
+        with open(src, 'wb') as fp:
+          fp.write(source)
+        command = [compiler] + args + ['-c', src, '-o', obj]
+        if header.get('cwd'):
+          command.append('-fdebug-prefix-map={}={}'.format(tmpdir, header['cwd']))
+        proc = subprocess.run(command, cwd=tmpdir, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        output = proc.stdout.decode('utf8', 'replace').replace(src, header['name'])
+        if proc.returncode != 0:
+          return {'status': 'failed', 'returncode': proc.returncode, 'output': output},
+        with open(obj, 'rb') as fp:
+          return {'status': 'ok', 'returncode': 0, 'output': output}, fp.read()
+    finally:
+      self.server.release()
+
+
+def serve(args):
+  secret = get_secret()
+  if args.secret_file:
+    with open(args.secret_file, 'rb') as fp:
+      secret = fp.read().strip()
+  if not secret and args.host not in ('127.0.0.1', 'localhost', '::1'):
+    print('error: a secret is required to listen on {} (--secret-file or ${})'
+      .format(args.host, SECRET_ENVIRON_KEY), file=sys.stderr)
+    return 1
+  worker = Worker((args.host, args.port), args.jobs, secret)
+  print('dist-compile worker listening on {}:{} ({} jobs)'.format(args.host, args.port, args.jobs))
+  sys.stdout.flush()
+  try:
+    worker.serve_forever()
+  except KeyboardInterrupt:
+    pass
+  finally:
+    worker.server_close()
+  return 0
+
+
+# Client
+# ======
+
+def expand_response_files(command):
+  result = []
+  for arg in command:
+    if arg.startswith('@') and os.path.isfile(arg[1:]):
+      with open(arg[1:]) as fp:
+        result += shlex.split(fp.read())
+    else:
+      result.append(arg)
+  return result
+
+
+class CompileCommand:
+  """
+  The parts of a compile command that are needed to split it into the local
+  preprocessing and the remote compilation. #ok is #False if the command can
+  not be distributed.
+  """
+
+  def __init__(self, command):
+    self.command = command
+    self.sources = []
+    self.output = None
+    self.compile_only = False
+    self.has_depfile = False
+    self.has_dep_target = False
+    self.ok = True
+    args = iter(enumerate(command))
+    next(args)
+    for index, arg in args:
+      if arg == '-c':
+        self.compile_only = True
+      elif arg.startswith(LOCAL_ONLY_PREFIXES):
+        self.ok = False
+      elif arg in OPTIONS_WITH_VALUE:
+        value = next(args, (None, None))[1]
+        if arg == '-o':
+          self.output = value
+        elif arg in ('-MT', '-MQ'):
+          self.has_dep_target = True
+      elif arg in ('-MD', '-MMD'):
+        self.has_depfile = True
+      elif not arg.startswith('-'):
+        self.sources.append(arg)
+    self.ok = self.ok and self.compile_only and self.output and len(self.sources) == 1
+    self.ok = self.ok and all(is_allowed_arg(x) for x in self.get_compile_args())
+
+  def get_preprocess_command(self, output):
+    result = []
+    args = iter(self.command)
+    for arg in args:
+      if arg == '-c':
+        result.append('-E')
+      elif arg == '-o':
+        next(args, None)
+        result += ['-o', output]
+      else:
+        result.append(arg)
+    if self.has_depfile and not self.has_dep_target:
+      result += ['-MT', self.output]
+    return result
+
+  def get_compile_args(self):
+    result = []
+    args = iter(self.command[1:])
+    for arg in args:
+      if arg in PREPROCESSOR_WITH_VALUE or arg in ('-o', '-x'):
+        next(args, None)
+      elif arg == '-c' or arg in self.sources or arg.startswith(PREPROCESSOR_PREFIXES):
+        pass
+      else:
+        result.append(arg)
+    return result
+
+
+def query_load(address, timeout):
+  try:
+    with socket.create_connection(address, timeout=timeout) as sock:
+      send_message(sock, {'type': 'status'})
+      header = recv_message(sock)[0]
+    return header['load'] / max(1, header['jobs'])
+  except (OSError, ValueError, KeyError, struct.error):
+    return None
+
+
+def parse_address(value):
+  host, _, port = value.strip().rpartition(':')
+  return (host or 'localhost', int(port or DEFAULT_PORT))
+
+
+def compile_remote(workers, cmd, preprocessed, timeout):
+  """
+  Sends the preprocessed source to the least loaded worker that accepts it.
+  Returns the response and the object data, or #None if no worker compiled
+  the source.
+  """
+
+  identity = get_identity(cmd.command[0])
+  if not identity:
+    return None
+  loads = [(query_load(x, timeout), x) for x in workers]
+  loads = sorted((load, x) for load, x in loads if load is not None and load < 1)
+  source = cmd.sources[0]
+  suffix = '.i' if source.endswith('.c') else '.ii'
+  request = {'type': 'compile', 'compiler': os.path.basename(cmd.command[0]),
+    'identity': identity, 'args': cmd.get_compile_args(), 'suffix': suffix,
+    'name': source, 'cwd': os.getcwd()}
+  secret = get_secret()
+  if secret:
+    request['signature'] = sign(secret, request, preprocessed)
+  for load, address in loads:
+    try:
+      with socket.create_connection(address, timeout=timeout) as sock:
+        sock.settimeout(None)
+        send_message(sock, request, preprocessed)
+        header, payload = recv_message(sock)
+    except (OSError, ValueError, struct.error):
+      continue
+    if header.get('status') in ('ok', 'failed'):
+      return header, payload
+  return None
+
+
+def compile(args):
+  command = args.command[1:] if args.command[:1] == ['--'] else args.command
+  if not command:
+    print('error: missing compile command', file=sys.stderr)
+    return 1
+  workers = [parse_address(x) for x in args.workers.split(',') if x.strip()]
+  cmd = CompileCommand(expand_response_files(command))
+  if not workers or not cmd.ok:
+    return subprocess.call(command)
+
+  # Preprocess locally, which also writes the depfile.
+  preprocessed_file = cmd.output + ('.i' if cmd.sources[0].endswith('.c') else '.ii')
+  res = subprocess.call(cmd.get_preprocess_command(preprocessed_file))
+  if res != 0:
+    return res
+  try:
+    with open(preprocessed_file, 'rb') as fp:
+      preprocessed = fp.read()
+  finally:
+    os.remove(preprocessed_file)
+
+  result = compile_remote(workers, cmd, preprocessed, args.timeout)
+  if result is None:
+    return subprocess.call(command)
+  header, obj = result
+  if header['output']:
+    sys.stderr.write(header['output'])
+  if header['status'] != 'ok':
+    return header['returncode'] or 1
+  temp = cmd.output + '.tmp'
+  with open(temp, 'wb') as fp:
+    fp.write(obj)
+  os.replace(temp, cmd.output)
+  return 0
+
+
+def get_argument_parser(prog=None):
+  parser = argparse.ArgumentParser(prog=prog)
+  subparsers = parser.add_subparsers(dest='subcommand')
+
+  serve_parser = subparsers.add_parser('serve', help='Run a worker daemon.')
+  serve_parser.add_argument('--host', default='127.0.0.1',
+    help='The address to listen on. Other than 127.0.0.1 requires a secret.')
+  serve_parser.add_argument('--port', type=int, default=DEFAULT_PORT, help='The port to listen on.')
+  serve_parser.add_argument('--jobs', type=int, default=os.cpu_count() or 1,
+    help='The maximum number of concurrent compile jobs.')
+  serve_parser.add_argument('--secret-file',
+    help='A file with the secret that clients sign their requests with.')
+
+  compile_parser = subparsers.add_parser('compile', help='Compile on a worker.')
+  compile_parser.add_argument('--workers', required=True, help='Comma separated list of host:port.')
+  compile_parser.add_argument('--timeout', type=float, default=1.0,
+    help='Timeout in seconds to connect to a worker.')
+  compile_parser.add_argument('command', nargs=argparse.REMAINDER,
+    help='The compile command. Must be preceded by --.')
+  return parser
+
+
+def main(argv=None, prog=None):
+  parser = get_argument_parser(prog)
+  args = parser.parse_args(argv)
+  if args.subcommand == 'serve':
+    return serve(args)
+  elif args.subcommand == 'compile':
+    return compile(args)
+  parser.print_usage()
+  return 1
+
+
+if __name__ == '__main__':
+  sys.exit(main())
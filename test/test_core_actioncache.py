@@ -0,0 +1,129 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import os
+import pytest
+
+from craftr.core import actioncache
+from craftr.core.build import relocate_paths
+
+
+class FakeOperator:
+  tool_identity = None
+
+
+class FakeBuildSet:
+  """
+  Provides the parts of the #BuildSet interface that the #ActionCache uses.
+  """
+
+  operator = FakeOperator()
+
+  def __init__(self, cwd, inputs, outputs, depfile=None):
+    self.cwd = cwd
+    self.inputs = inputs
+    self.outputs = {'out': outputs}
+    self.depfile = depfile
+
+  def get_cwd(self):
+    return self.cwd
+
+  def get_input_files(self):
+    return self.inputs
+
+  def get_commands(self):
+    return []
+
+  def compute_hash(self, roots=None):
+    return 'hash'
+
+
+def test_read_depfile(tmpdir):
+  depfile = tmpdir.join('main.o.d')
+  depfile.write('main.o: main.c config.h \\\n  dir/with\\ space.h\nconfig.h:\n')
+  assert actioncache.read_depfile(str(depfile)) == \
+    ['main.c', 'config.h', 'dir/with space.h']
+
+
+def test_relocate_paths():
+  roots = {'SOURCE': '/work/src', 'BUILD': '/work/src/build'}
+  value = {'/work/src/build/main.o': ['-I/work/src/include', '-o', '/work/src/build/main.o']}
+  relocated = relocate_paths(value, roots)
+  assert relocated == {'@BUILD@/main.o': ['-I@SOURCE@/include', '-o', '@BUILD@/main.o']}
+  assert relocate_paths(relocated, roots, restore=True) == value
+
+
+def test_lookup_and_store(tmpdir):
+  cache = actioncache.ActionCache(actioncache.DiskStore(str(tmpdir.join('cache'))))
+  source = tmpdir.join('main.c')
+  source.write('int main() { }')
+  output = tmpdir.join('main.o')
+  build_set = FakeBuildSet(str(tmpdir), [str(source)], [str(output)])
+
+  assert not cache.lookup(build_set)
+  output.write('object')
+  assert cache.store(build_set)
+  output.remove()
+  assert cache.lookup(build_set)
+  assert output.read() == 'object'
+
+  # A change of an input file changes the action key.
+  source.write('int main() { return 1; }')
+  assert not cache.lookup(build_set)
+
+
+def test_inputs_that_are_not_files(tmpdir):
+  cache = actioncache.ActionCache(actioncache.DiskStore(str(tmpdir.join('cache'))))
+  output = tmpdir.join('out.txt')
+  output.write('output')
+  for inputs in [[str(tmpdir.join('missing.txt'))], [str(tmpdir.mkdir('dir'))]]:
+    build_set = FakeBuildSet(str(tmpdir), inputs, [str(output)])
+    assert cache.get_action_key(build_set) is None
+    assert not cache.store(build_set)
+    assert not cache.lookup(build_set)
+
+
+def test_lookup_and_store_with_depfile(tmpdir):
+  cache = actioncache.ActionCache(actioncache.DiskStore(str(tmpdir.join('cache'))))
+  source = tmpdir.join('main.c')
+  source.write('#include "config.h"')
+  header = tmpdir.join('config.h')
+  header.write('#define A 1')
+  output = tmpdir.join('main.o')
+  depfile = tmpdir.join('main.o.d')
+  build_set = FakeBuildSet(str(tmpdir), [str(source)], [str(output)], 'main.o.d')
+
+  output.write('object')
+  depfile.write('main.o: main.c config.h\n')
+  assert cache.store(build_set)
+  output.remove()
+  depfile.remove()
+  assert cache.lookup(build_set)
+  assert output.read() == 'object'
+  assert depfile.read() == 'main.o: main.c config.h\n'
+
+  # The implicit inputs from the depfile are part of the second-level key.
+  header.write('#define A 2')
+  assert not cache.lookup(build_set)
+  header.remove()
+  assert not cache.lookup(build_set)
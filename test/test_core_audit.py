@@ -0,0 +1,70 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import os
+import pytest
+
+from craftr.core import audit
+
+
+TRACE = '''\
+100   execve("/usr/bin/cc", ["cc", "-c", "main.c"], 0x7ffd /* 20 vars */) = 0
+100   openat(AT_FDCWD, "/etc/ld.so.cache", O_RDONLY|O_CLOEXEC) = 3</etc/ld.so.cache>
+101   openat(AT_FDCWD, "main.c", O_RDONLY|O_NOCTTY) = 3</work/main.c>
+101   openat(AT_FDCWD, "config.h", O_RDONLY|O_NOCTTY <unfinished ...>
+102   openat(AT_FDCWD, "/tmp/cc.s", O_WRONLY|O_CREAT|O_TRUNC, 0666) = 4</tmp/cc.s>
+101   <... openat resumed>) = 5</work/config.h>
+101   openat(AT_FDCWD, "missing.h", O_RDONLY) = -1 ENOENT (No such file or directory)
+102   creat("/work/out.o", 0666) = 6</work/out.o>
+101   +++ exited with 0 +++
+'''
+
+
+def test_parse_trace():
+  reads, writes = audit.parse_trace(TRACE)
+  assert reads >= {'/etc/ld.so.cache', '/work/main.c', '/work/config.h'}
+  assert not any(x.endswith('missing.h') for x in reads)
+  assert writes == {'/tmp/cc.s', '/work/out.o'}
+
+
+def test_find_undeclared(tmpdir):
+  files = {}
+  for name in ['src/main.c', 'src/config.h', 'sys/stdio.h', 'tools/lib.h']:
+    files[name] = str(tmpdir.join(name))
+    tmpdir.join(name).ensure()
+  reads = set(files.values()) | {str(tmpdir.join('deleted.h'))}
+  result = audit.find_undeclared(reads, set(), {files['src/main.c']},
+    ignore=[str(tmpdir.join('tools'))], system=[str(tmpdir)], project=[str(tmpdir.join('src'))])
+  # Project files are reported even though the project is in a system directory.
+  assert result == [files['src/config.h']]
+
+
+def test_get_config():
+  assert audit.get_config({}, '/build', 'debug') is None
+  with pytest.raises(ValueError):
+    audit.get_config({'build:audit': 'yes'}, '/build', 'debug')
+  config = audit.get_config({'build:audit': 'record', 'build:auditIgnore': '/x, /y'}, '/build', 'debug')
+  assert config['mode'] == 'record'
+  assert {'/x', '/y'} <= set(config['ignore'])
+  assert os.path.realpath('/build') in config['project']
+  assert '/var' not in config['system'] and '/opt' not in config['system']
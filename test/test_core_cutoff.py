@@ -0,0 +1,62 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import os
+import pytest
+
+from craftr.core import cutoff
+
+
+class FakeBuildSet:
+
+  def __init__(self, outputs):
+    self.outputs = {'out': outputs}
+
+
+def test_newest_mtime(tmpdir):
+  a, b = tmpdir.join('a'), tmpdir.join('b')
+  a.write('a')
+  b.write('b')
+  os.utime(str(a), (100, 100))
+  os.utime(str(b), (200, 200))
+  assert cutoff.newest_mtime([str(a), str(b), str(tmpdir.join('missing'))]) == 200
+  assert cutoff.newest_mtime([str(tmpdir.join('missing'))]) == 0
+
+
+def test_restore_unchanged(tmpdir):
+  same, changed, created = tmpdir.join('same'), tmpdir.join('changed'), tmpdir.join('created')
+  same.write('same')
+  changed.write('old')
+  os.utime(str(same), (100, 100))
+  os.utime(str(changed), (100, 100))
+  snapshot = cutoff.OutputSnapshot(FakeBuildSet([str(same), str(changed), str(created)]))
+  assert sorted(snapshot.files) == sorted([str(same), str(changed)])
+
+  same.write('same')
+  changed.write('new')
+  created.write('created')
+  os.utime(str(same), (300, 300))
+  os.utime(str(changed), (300, 300))
+  assert snapshot.restore_unchanged() == [str(same)]
+  assert os.path.getmtime(str(same)) == 100
+  assert os.path.getmtime(str(changed)) == 300
@@ -0,0 +1,59 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import pytest
+
+from craftr.core import dyndep
+
+
+def test_loads():
+  entries = dyndep.loads(
+    'ninja_dyndep_version = 1\n'
+    'build main.o: dyndep | a.gcm b$ c.gcm\n'
+    '  restat = 1\n'
+    'build m.o | m.gcm: dyndep\n'
+    'build C$:/x.o: dyndep | y.gcm\n')
+  assert entries == {
+    'main.o': dyndep.Entry(['a.gcm', 'b c.gcm'], []),
+    'm.o': dyndep.Entry([], ['m.gcm']),
+    'C:/x.o': dyndep.Entry(['y.gcm'], []),
+  }
+
+
+def test_loads_errors():
+  with pytest.raises(ValueError):
+    dyndep.loads('ninja_dyndep_version = 2\n')
+  with pytest.raises(ValueError):
+    dyndep.loads('ninja_dyndep_version = 1\nbuild a.o: cc | b.h\n')
+  with pytest.raises(ValueError):
+    dyndep.loads('ninja_dyndep_version = 1\nbuild a.o b.o: dyndep\n')
+
+
+def test_dumps_round_trip():
+  entries = {
+    'main.o': dyndep.Entry(['a.gcm', 'dir with space/b.gcm', 'C:/c.gcm'], []),
+    'm.o': dyndep.Entry([], ['m$.gcm']),
+  }
+  text = dyndep.dumps(entries)
+  assert text.startswith('ninja_dyndep_version = 1\n')
+  assert dyndep.loads(text) == entries
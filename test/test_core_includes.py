@@ -0,0 +1,70 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import pytest
+
+from craftr.core.includes import IncludeGraph, Unit, pch_candidates, rank_by_parse_cost
+
+
+@pytest.fixture
+def headers(tmpdir):
+  files = {
+    'big.h': '#include "small.h"\n' + 'int x;\n' * 99,
+    'small.h': 'int y;\n' * 10,
+    'other/small.h': 'int z;\n' * 5,
+    'rare.h': 'int w;\n' * 1000,
+  }
+  result = {}
+  for name, content in files.items():
+    tmpdir.join('include', name).write(content, ensure=True)
+    result[name] = str(tmpdir.join('include', name))
+  return result
+
+
+def test_edges(headers):
+  graph = IncludeGraph([Unit('a', 'a.c', 'a.o', [headers['big.h'], headers['small.h'],
+                                                 headers['other/small.h']])])
+  # The include resolves to the header in the same directory.
+  assert graph.edges(headers['big.h']) == [headers['small.h']]
+  assert graph.closure(headers['big.h']) == {headers['big.h'], headers['small.h']}
+  assert graph.transitive_lines(headers['big.h']) == 110
+
+
+def test_rank_by_parse_cost(headers):
+  units = [Unit('a', 'a{}.c'.format(i), 'a{}.o'.format(i), [headers['big.h'], headers['small.h']])
+           for i in range(4)]
+  units.append(Unit('a', 'r.c', 'r.o', [headers['rare.h']]))
+  graph = IncludeGraph(units)
+  assert rank_by_parse_cost(graph) == [
+    (headers['rare.h'], 1000), (headers['big.h'], 4 * 110), (headers['small.h'], 4 * 10)]
+
+
+def test_pch_candidates(headers):
+  units = [Unit('a', 'a{}.c'.format(i), 'a{}.o'.format(i), [headers['big.h'], headers['small.h']])
+           for i in range(3)]
+  units.append(Unit('a', 'r.c', 'r.o', [headers['rare.h']]))
+  graph = IncludeGraph(units)
+  # small.h is included by big.h anyway, rare.h by too few sources.
+  assert pch_candidates(graph, units, 0.5) == [headers['big.h']]
+  assert pch_candidates(graph, units, 0.2) == [headers['rare.h'], headers['big.h']]
+  assert pch_candidates(graph, units, 0.2, top=1) == [headers['rare.h']]
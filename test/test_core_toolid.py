@@ -0,0 +1,104 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import os
+import pytest
+
+from craftr.core import build, toolid
+
+pytestmark = pytest.mark.skipif(os.name == 'nt', reason='uses a shell script as the tool')
+
+
+def make_tool(tmpdir, version, name='mycc'):
+  tool = tmpdir.join('bin', name)
+  tool.write('#!/bin/sh\necho x >> "{}"\necho "mycc {}"\n'.format(tmpdir.join('calls'), version),
+    ensure=True)
+  tool.chmod(0o755)
+  return tool
+
+
+def test_resolve_tool(tmpdir):
+  tool = make_tool(tmpdir, '1.0')
+  environ = {'PATH': str(tmpdir.join('bin'))}
+  assert toolid.resolve_tool('mycc', environ) == str(tool)
+  assert toolid.resolve_tool('does-not-exist', environ) is None
+
+
+def test_compute_identity(tmpdir):
+  tool = make_tool(tmpdir, '1.0')
+  identity = toolid.compute_identity(str(tool))
+  assert identity['path'] == os.path.realpath(str(tool))
+  assert identity['size'] == tool.size()
+  assert identity['version'] == 'mycc 1.0'
+  assert identity['digest']
+
+
+def test_identity_cache(tmpdir):
+  tool = make_tool(tmpdir, '1.0')
+  environ = {'PATH': str(tmpdir.join('bin'))}
+  filename = str(tmpdir.join('cache', 'tools.json'))
+  cache = toolid.ToolIdentityCache(filename)
+  first = cache.get('mycc', environ)
+  assert first['version'] == 'mycc 1.0'
+  assert cache.get('mycc', environ) == first
+  assert len(tmpdir.join('calls').readlines()) == 1
+  cache.save()
+
+  # The persistent cache does not run the tool again.
+  assert toolid.ToolIdentityCache(filename).get('mycc', environ) == first
+  assert len(tmpdir.join('calls').readlines()) == 1
+
+  # Replacing the tool changes its inode and modification time.
+  tool.remove()
+  os.utime(str(make_tool(tmpdir, '2.0')), (100, 100))
+  cache = toolid.ToolIdentityCache(filename)
+  assert cache.get('mycc', environ)['version'] == 'mycc 2.0'
+  assert cache.changed
+
+
+def test_multi_command_link(tmpdir):
+  # The link operator post-processes the product with another tool. Its
+  # identity must still follow the linker.
+  make_tool(tmpdir, '1.0', 'objcopy')
+  environ = {'PATH': str(tmpdir.join('bin'))}
+  commands = [['mycc', '-o', '${@product}', '${<in}'],
+              ['objcopy', '--strip-debug', '${@product}']]
+
+  def link_hash():
+    master = build.Master()
+    target = master.add_target(build.Target(master, 'main'))
+    op = target.add_operator(build.Operator(master, 'link', build.Commands(commands),
+      environ=environ, tool='mycc'))
+    bset = build.BuildSet(master)
+    bset.add_input_files('in', [str(tmpdir.join('main.o'))])
+    bset.add_output_files('product', [str(tmpdir.join('main'))])
+    op.add_build_set(bset)
+    assert op.tool_identity['path'] == os.path.realpath(str(tmpdir.join('bin', 'mycc')))
+    return bset.compute_hash()
+
+  make_tool(tmpdir, '1.0')
+  first = link_hash()
+  assert link_hash() == first
+  tmpdir.join('bin', 'mycc').remove()
+  make_tool(tmpdir, '2.0')
+  assert link_hash() != first
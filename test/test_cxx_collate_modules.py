@@ -0,0 +1,117 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import importlib.util
+import json
+import os
+import pytest
+
+from craftr.core import dyndep
+
+TOOL = os.path.join(os.path.dirname(__file__), '..', 'src', 'craftr', 'stdlib',
+                    'net.craftr.lang', 'cxx', 'tools', 'collate_modules.py')
+
+spec = importlib.util.spec_from_file_location('collate_modules', TOOL)
+collate_modules = importlib.util.module_from_spec(spec)
+spec.loader.exec_module(collate_modules)
+
+
+def write_json(tmpdir, name, data):
+  tmpdir.join(name).write(json.dumps(data))
+  return str(tmpdir.join(name))
+
+
+def ddi(provides=(), requires=()):
+  return {'version': 0, 'rules': [{
+    'primary-output': 'x.o',
+    'provides': [{'logical-name': x} for x in provides],
+    'requires': [{'logical-name': x} for x in requires]}]}
+
+
+def make_plan(tmpdir, units, format='gcc', header_units=None):
+  """
+  Creates the plan for the *units*, a list of tuples of the source name,
+  whether it is an interface and the P1689 rules. A dependency provides
+  the module `dep`.
+  """
+
+  dep = write_json(tmpdir, 'dep.modules.json', {'modules': {'dep': {'bmi': '/dep/dep.gcm', 'closure': {}}}})
+  sources = []
+  for name, interface, rules in units:
+    sources.append({
+      'src': name + '.cpp',
+      'obj': str(tmpdir.join(name + '.o')),
+      'bmi': str(tmpdir.join(name + '.gcm')) if interface else None,
+      'ddi': write_json(tmpdir, name + '.ddi', rules),
+      'modmap': str(tmpdir.join(name + '.modmap'))})
+  return {'deps': [dep], 'sources': sources, 'header_units': header_units or {},
+          'header_unit_dir': None, 'format': format,
+          'dyndep': str(tmpdir.join('modules.dd')),
+          'modules': str(tmpdir.join('modules.json'))}
+
+
+def test_collate(tmpdir):
+  plan = make_plan(tmpdir, [
+    ('a', True, ddi(provides=['a'], requires=['dep'])),
+    ('b', True, ddi(provides=['b'], requires=['a'])),
+    ('main', False, ddi(requires=['b']))])
+  collate_modules.collate(plan)
+
+  gcm = lambda x: str(tmpdir.join(x + '.gcm'))
+  assert tmpdir.join('a.modmap').read() == 'a {}\ndep /dep/dep.gcm\n'.format(gcm('a'))
+  # Imports are transitive, BMIs need the BMIs of their imports.
+  assert tmpdir.join('main.modmap').read() == \
+    'a {}\nb {}\ndep /dep/dep.gcm\n'.format(gcm('a'), gcm('b'))
+
+  entries = dyndep.load(plan['dyndep'])
+  assert entries[str(tmpdir.join('main.o'))].implicit_inputs == \
+    sorted(['/dep/dep.gcm', gcm('a'), gcm('b')])
+  assert entries[str(tmpdir.join('a.o'))].implicit_inputs == ['/dep/dep.gcm']
+
+  modules = json.loads(tmpdir.join('modules.json').read())['modules']
+  assert modules['a'] == {'bmi': gcm('a'), 'closure': {'dep': '/dep/dep.gcm'}}
+  assert modules['b']['closure'] == {'a': gcm('a'), 'dep': '/dep/dep.gcm'}
+
+
+def test_collate_clang(tmpdir):
+  plan = make_plan(tmpdir, [
+    ('a', True, ddi(provides=['a'])),
+    ('main', False, ddi(requires=['a', '<vector>']))],
+    format='clang', header_units={'vector': '/hu/vector.pcm'})
+  collate_modules.collate(plan)
+  assert tmpdir.join('main.modmap').read() == \
+    '"-fmodule-file=a={}"\n"-fmodule-file=/hu/vector.pcm"\n'.format(tmpdir.join('a.gcm'))
+
+
+@pytest.mark.parametrize('units,message', [
+  ([('a', True, ddi(provides=['a'], requires=['b'])),
+    ('b', True, ddi(provides=['b'], requires=['a']))], 'cyclic module imports'),
+  ([('main', False, ddi(requires=['missing']))], 'unknown module "missing"'),
+  ([('a', True, ddi(provides=['dep']))], 'provided more than once'),
+  ([('a', False, ddi(provides=['a']))], 'not a module interface unit'),
+  ([('main', False, ddi(requires=['<vector>']))], 'not listed in cxx.headerUnits'),
+])
+def test_collate_errors(tmpdir, units, message):
+  with pytest.raises(collate_modules.CollateError) as excinfo:
+    collate_modules.collate(make_plan(tmpdir, units))
+  assert message in str(excinfo.value)
@@ -0,0 +1,73 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import importlib.util
+import os
+import shutil
+import subprocess
+import pytest
+
+TOOL = os.path.join(os.path.dirname(__file__), '..', 'src', 'craftr', 'stdlib',
+                    'net.craftr.lang', 'cxx', 'tools', 'interface_stub.py')
+
+spec = importlib.util.spec_from_file_location('interface_stub', TOOL)
+interface_stub = importlib.util.module_from_spec(spec)
+spec.loader.exec_module(interface_stub)
+
+
+def test_parse_nm():
+  before = interface_stub.parse_nm(
+    'compute T 0000000000001119 000000000000000b\n'
+    'table D 0000000000004010 0000000000000010\n'
+    'helper W 0000000000001130 0000000000000020\n')
+  after = interface_stub.parse_nm(
+    'helper W 0000000000001150 0000000000000040\n'
+    'compute T 0000000000001119 0000000000000032\n'
+    'table D 0000000000004040 0000000000000010\n')
+  assert before == after == 'compute T\nhelper W\ntable D 0000000000000010\n'
+
+  # A change of the size of a data object changes the stub.
+  assert interface_stub.parse_nm('table D 0000000000004040 0000000000000020\n') != \
+    interface_stub.parse_nm('table D 0000000000004040 0000000000000010\n')
+
+
+@pytest.mark.skipif(not shutil.which('gcc') or not shutil.which('nm'), reason='requires gcc and nm')
+def test_edited_function_body(tmpdir):
+  source = tmpdir.join('lib.c')
+  library = str(tmpdir.join('libfoo.so'))
+  stub = str(tmpdir.join('libfoo.so.ifs'))
+
+  def build_stub(body):
+    source.write('int table[4];\nint compute(int x) {{ {} }}\n'.format(body))
+    subprocess.check_call(['gcc', '-shared', '-fPIC', '-o', library, str(source)])
+    assert interface_stub.main(['-o', stub, '--format=nm', '--',
+      'nm', '-D', '--defined-only', '-P', '-S', library]) == 0
+    with open(stub) as fp:
+      return fp.read(), os.stat(stub).st_mtime_ns
+
+  content, mtime = build_stub('return x;')
+  assert 'compute' in content and 'table' in content
+  os.utime(stub, ns=(mtime - 10**9, mtime - 10**9))
+  mtime -= 10**9
+  assert build_stub('int y = x * x; for (int i = 0; i < x; ++i) y += i; return y;') == \
+    (content, mtime)
@@ -0,0 +1,78 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import importlib.util
+import os
+import sys
+import pytest
+
+TOOL = os.path.join(os.path.dirname(__file__), '..', 'src', 'craftr', 'stdlib',
+                    'net.craftr.lang', 'cxx', 'tools', 'pgo_profile.py')
+
+spec = importlib.util.spec_from_file_location('pgo_profile', TOOL)
+pgo_profile = importlib.util.module_from_spec(spec)
+spec.loader.exec_module(pgo_profile)
+
+# A merge command that concatenates the raw profiles into the -o file.
+MERGE = [sys.executable, '-c', 'import sys; i = sys.argv.index("-o"); '
+  'open(sys.argv[i+1], "wb").write(b"".join(open(x, "rb").read() for x in sys.argv[i+2:]))']
+
+
+def write_raw(tmpdir, files):
+  for name, content in files.items():
+    tmpdir.join('raw', name).write(content, ensure=True)
+  return str(tmpdir.join('raw'))
+
+
+def test_digest(tmpdir):
+  rawdir = write_raw(tmpdir, {'a/main.gcda': 'counters', 'b.gcda': 'more'})
+  output = str(tmpdir.join('profile.txt'))
+  assert pgo_profile.main([output, rawdir]) == 0
+  digest = tmpdir.join('profile.txt').read()
+
+  # The same profile data keeps the timestamp of the output.
+  os.utime(output, (100, 100))
+  assert pgo_profile.main([output, rawdir]) == 0
+  assert tmpdir.join('profile.txt').read() == digest
+  assert os.path.getmtime(output) == 100
+
+  tmpdir.join('raw', 'b.gcda').write('changed')
+  assert pgo_profile.main([output, rawdir]) == 0
+  assert tmpdir.join('profile.txt').read() != digest
+
+
+def test_merge(tmpdir):
+  rawdir = write_raw(tmpdir, {'a.profraw': 'A', 'b.profraw': 'B'})
+  output = str(tmpdir.join('default.profdata'))
+  assert pgo_profile.main([output, rawdir, '--'] + MERGE) == 0
+  assert tmpdir.join('default.profdata').read() == 'AB'
+  assert not os.path.exists(output + '.tmp')
+
+  os.utime(output, (100, 100))
+  assert pgo_profile.main([output, rawdir, '--'] + MERGE) == 0
+  assert os.path.getmtime(output) == 100
+
+
+def test_no_profile_data(tmpdir):
+  tmpdir.mkdir('raw')
+  assert pgo_profile.main([str(tmpdir.join('out')), str(tmpdir.join('raw'))]) == 1
@@ -0,0 +1,56 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import importlib.util
+import os
+import pytest
+
+TOOL = os.path.join(os.path.dirname(__file__), '..', 'src', 'craftr', 'stdlib',
+                    'net.craftr.lang', 'cxx', 'tools', 'replace_if_changed.py')
+
+spec = importlib.util.spec_from_file_location('replace_if_changed', TOOL)
+replace_if_changed = importlib.util.module_from_spec(spec)
+spec.loader.exec_module(replace_if_changed)
+
+
+def test_replace_if_changed(tmpdir):
+  src, dst = tmpdir.join('new'), tmpdir.join('out')
+
+  # The destination is created if it does not exist.
+  src.write('a')
+  assert replace_if_changed.main([str(src), str(dst)]) == 0
+  assert dst.read() == 'a' and not src.exists()
+
+  # Same contents: the destination keeps its timestamp.
+  os.utime(str(dst), (100, 100))
+  src.write('a')
+  assert replace_if_changed.main([str(src), str(dst)]) == 0
+  assert os.path.getmtime(str(dst)) == 100 and not src.exists()
+
+  src.write('b')
+  assert replace_if_changed.main([str(src), str(dst)]) == 0
+  assert dst.read() == 'b' and not src.exists()
+
+
+def test_usage():
+  assert replace_if_changed.main(['only-one']) == 1
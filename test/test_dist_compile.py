@@ -0,0 +1,126 @@
+# -*- coding: utf8 -*-
+# The MIT License (MIT)
+#
+# Copyright (c) 2018  Niklas Rosenstein
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import importlib.util
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import time
+import pytest
+
+TOOL = os.path.join(os.path.dirname(__file__), '..', 'src', 'craftr', 'stdlib',
+                    'net.craftr.tool', 'dist-compile.py')
+
+spec = importlib.util.spec_from_file_location('dist_compile', TOOL)
+dist_compile = importlib.util.module_from_spec(spec)
+spec.loader.exec_module(dist_compile)
+
+needs_gcc = pytest.mark.skipif(not shutil.which('gcc'), reason='requires gcc')
+
+
+def free_port():
+  with socket.socket() as sock:
+    sock.bind(('127.0.0.1', 0))
+    return sock.getsockname()[1]
+
+
+@pytest.fixture
+def workers(tmpdir, monkeypatch):
+  monkeypatch.setenv('XDG_CACHE_HOME', str(tmpdir.join('cache')))
+  monkeypatch.setenv(dist_compile.SECRET_ENVIRON_KEY, 'test-secret')
+  addresses = [('127.0.0.1', free_port()) for _ in range(2)]
+  procs = [subprocess.Popen([sys.executable, TOOL, 'serve', '--port', str(port), '--jobs', '1'],
+                            stdout=subprocess.DEVNULL) for _, port in addresses]
+  try:
+    for address in addresses:
+      for _ in range(100):
+        if dist_compile.query_load(address, 0.2) is not None:
+          break
+        time.sleep(0.05)
+      else:
+        pytest.fail('worker {} did not start'.format(address))
+    yield addresses
+  finally:
+    for proc in procs:
+      proc.terminate()
+      proc.wait()
+
+
+def test_is_allowed_arg():
+  for arg in ['-O2', '-g', '-Wall', '-w', '-std=c++17', '-fPIC', '-fno-exceptions',
+              '-fvisibility=hidden', '-fdiagnostics-color=always', '-march=native']:
+    assert dist_compile.is_allowed_arg(arg), arg
+  for arg in ['-wrapper', '-fplugin=evil.so', '-B/tmp', '-specs=x', '@args', '-Wa,@x',
+              '-fdump-tree-all', 'sh', '-c', '-fpass-plugin=evil.so',
+              '-foptimization-record-file=/tmp/x', '-fcrash-diagnostics-dir=/tmp',
+              '-fproc-stat-report=/tmp/x', '-fprofile-generate', '-fno-plugin', '-mllvm']:
+    assert not dist_compile.is_allowed_arg(arg), arg
+
+
+@needs_gcc
+def test_compile_on_workers(tmpdir, workers):
+  src = tmpdir.join('main.c')
+  src.write('int add(int a, int b) { return a + b; }\n')
+  cmd = dist_compile.CompileCommand(['gcc', '-O2', '-c', str(src), '-o', str(tmpdir.join('main.o'))])
+  assert cmd.ok
+  preprocessed = b'int add(int a, int b) { return a + b; }\n'
+
+  # Each worker compiles the source.
+  for address in workers:
+    header, obj = dist_compile.compile_remote([address], cmd, preprocessed, 1.0)
+    assert header['status'] == 'ok'
+    assert obj.startswith(b'\x7fELF')
+
+  # The compile subcommand distributes it and writes the depfile locally.
+  obj = tmpdir.join('main.o')
+  dep = tmpdir.join('main.d')
+  res = subprocess.call([sys.executable, TOOL, 'compile', '--workers',
+    ','.join('{}:{}'.format(*x) for x in workers), '--', 'gcc', '-MMD', '-MF', str(dep),
+    '-c', str(src), '-o', str(obj)], cwd=str(tmpdir))
+  assert res == 0
+  assert obj.check() and dep.check()
+
+
+@needs_gcc
+def test_worker_rejects_requests(workers, monkeypatch):
+  def request(**kwargs):
+    header = {'type': 'compile', 'compiler': 'gcc', 'identity': dist_compile.get_identity('gcc'),
+              'args': ['-O2'], 'suffix': '.i', 'name': 'main.c', 'cwd': '/'}
+    header.update(kwargs)
+    header['signature'] = dist_compile.sign(b'test-secret', header, b'')
+    with socket.create_connection(workers[0]) as sock:
+      dist_compile.send_message(sock, header)
+      return dist_compile.recv_message(sock)[0]['status']
+
+  assert request(compiler='sh', identity=None, args=['-c', 'touch /tmp/pwned']) == 'denied'
+  assert request(compiler='sh', identity=None, args=[]) == 'toolchain'
+  assert request(args=['-wrapper', 'sh,-c,true']) == 'denied'
+  assert request(args=['-fplugin=/tmp/evil.so']) == 'denied'
+  assert request(args=['-fpass-plugin=/tmp/evil.so']) == 'denied'
+  assert request(args=['-foptimization-record-file=/tmp/pwned']) == 'denied'
+  monkeypatch.setenv(dist_compile.SECRET_ENVIRON_KEY, 'wrong')
+  with socket.create_connection(workers[0]) as sock:
+    dist_compile.send_message(sock, {'type': 'compile', 'compiler': 'gcc', 'args': []})
+    assert dist_compile.recv_message(sock)[0]['status'] == 'denied'